@@ -198,8 +198,6 @@ static int 	grid = 0;
 static int 	leveljuststarted = 1; 	// kluge until AM_LevelInit() is called
 
 boolean    	automapactive = false;
-static int 	finit_width = SCREENWIDTH;
-static int 	finit_height = SCREENHEIGHT - 32;
 
 // location of window on screen
 static int 	f_x;
@@ -520,8 +518,8 @@ void AM_LevelInit(void)
     leveljuststarted = 0;
 
     f_x = f_y = 0;
-    f_w = finit_width;
-    f_h = finit_height;
+    f_w = SCREENWIDTH;
+    f_h = SCREENY(ST_Y);
 
     AM_clearMarks();
 
@@ -1322,8 +1320,10 @@ void AM_drawMarks(void)
 	    h = 6; // because something's wrong with the wad, i guess
 	    fx = CXMTOF(markpoints[i].x);
 	    fy = CYMTOF(markpoints[i].y);
-	    if (fx >= f_x && fx <= f_w - w && fy >= f_y && fy <= f_h - h)
-		V_DrawPatch(fx, fy, marknums[i]);
+	    if (fx >= f_x && fx <= f_w - SCREENX(w)
+	     && fy >= f_y && fy <= f_h - SCREENY(h))
+		V_DrawPatch(fx * ORIGWIDTH / SCREENWIDTH,
+			    fy * ORIGHEIGHT / SCREENHEIGHT, marknums[i]);
 	}
     }
 
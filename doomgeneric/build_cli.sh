@@ -6,8 +6,15 @@ CFLAGS="$CFLAGS -g"
 CFLAGS="$CFLAGS -DDOOMGENERIC_RESX=320 -DDOOMGENERIC_RESY=200 -DDISABLE_ZENITY"
 CC="${CC:-cc}"
 
+# render threads (Onramp doesn't have pthreads)
+LIBS=
+if [ "$CC" != "onrampcc" ]; then
+    LIBS="-lpthread"
+fi
+
 OBJDIR=build
 OUTPUT=doomgeneric
+REPLAY=cli_replay
 
 cd "$(dirname "$0")"
 
@@ -46,6 +53,7 @@ SRC_DOOM="
     m_fixed
     m_menu
     m_misc
+    m_profile
     m_random
     p_ceilng
     p_doors
@@ -74,6 +82,7 @@ SRC_DOOM="
     r_segs
     r_sky
     r_things
+    r_walk
     sha1
     sounds
     statdump
@@ -89,6 +98,7 @@ SRC_DOOM="
     w_wad
     z_zone
     w_file_stdc
+    w_file_posix
     i_input
     i_video
     doomgeneric
@@ -99,8 +109,8 @@ SRC_DOOM="
 if [ "$1" = "clean" ]; then
     echo "rm -rf $OBJDIR"
     rm -rf $OBJDIR
-    echo "rm -f $OUTPUT"
-    rm -f $OUTPUT
+    echo "rm -f $OUTPUT $REPLAY"
+    rm -f $OUTPUT $REPLAY
     exit 0
 fi
 
@@ -115,4 +125,9 @@ for name in $SRC_DOOM; do
     fi
 done
 echo "[Linking $OUTPUT]"
-$CC $CFLAGS $LDFLAGS $OBJS -o $OUTPUT
+$CC $CFLAGS $LDFLAGS $OBJS -o $OUTPUT $LIBS
+
+if ! [ -e $REPLAY ] || [ $REPLAY -ot cli_replay.c ]; then
+    echo "[Linking $REPLAY]"
+    $CC $CFLAGS $LDFLAGS cli_replay.c -o $REPLAY
+fi
@@ -0,0 +1,389 @@
+// Replays a terminal recording made with -record-tty
+//
+// Recordings are asciicast v2 files so they can also be played with
+// asciinema. This tool exists so we can push a recording to a terminal (or to
+// /dev/null) as fast as possible to benchmark terminals and transports
+// without the game in the way.
+//
+// Usage:
+//
+//     cli_replay [-max] [-speed N] [-o output] recording.cast
+//
+// Statistics are printed to standard error when the replay ends. The whole
+// recording is decoded into memory first, so they measure only the output.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+/*
+ * Options and other common state
+ */
+
+static bool max_speed;
+static double speed = 1.0;
+static int output_fd = STDOUT_FILENO;
+
+// the whole recording, and the line of it being parsed
+static char* text;
+static size_t text_capacity;
+static size_t text_count;
+static char* line;
+
+// the decoded output of every event, one after another
+static char* data;
+static size_t data_capacity;
+static size_t data_count;
+
+// The output events. All of them are decoded before the replay starts, so
+// that only writing the output is timed.
+typedef struct {
+    double time;
+    size_t offset;      // into data
+    size_t count;
+} event_t;
+
+static event_t* events;
+static size_t events_capacity;
+static size_t event_count;
+
+
+
+/*
+ * Input
+ */
+
+static void* grow(void* buffer, size_t* capacity, size_t needed) {
+    if (needed <= *capacity)
+        return buffer;
+    while (*capacity < needed)
+        *capacity = *capacity ? *capacity * 2 : 4096;
+    buffer = realloc(buffer, *capacity);
+    if (buffer == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        abort();
+    }
+    return buffer;
+}
+
+// Reads the whole file into the text buffer, with a terminating null.
+static bool read_file(FILE* file) {
+    for (;;) {
+        text = grow(text, &text_capacity, text_count + 65536 + 1);
+        size_t step = fread(text + text_count, 1, text_capacity - text_count - 1, file);
+        text_count += step;
+        if (step == 0)
+            break;
+    }
+    text[text_count] = 0;
+    return !ferror(file);
+}
+
+// Points line at the next line of the text buffer, cutting off the newline.
+// Returns false at the end of the text.
+static bool next_line(char** p) {
+    if (**p == 0)
+        return false;
+    line = *p;
+    char* end = strchr(line, '\n');
+    if (end != NULL) {
+        *end = 0;
+        *p = end + 1;
+    } else {
+        *p = line + strlen(line);
+    }
+    return true;
+}
+
+static void data_append(const char* bytes, size_t count) {
+    data = grow(data, &data_capacity, data_count + count);
+    memcpy(data + data_count, bytes, count);
+    data_count += count;
+}
+
+static void data_append_utf8(uint32_t codepoint) {
+    char out[4];
+    if (codepoint < 0x80) {
+        out[0] = codepoint;
+        data_append(out, 1);
+    } else if (codepoint < 0x800) {
+        out[0] = 0xC0 | (codepoint >> 6);
+        out[1] = 0x80 | (codepoint & 0x3F);
+        data_append(out, 2);
+    } else if (codepoint < 0x10000) {
+        out[0] = 0xE0 | (codepoint >> 12);
+        out[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+        out[2] = 0x80 | (codepoint & 0x3F);
+        data_append(out, 3);
+    } else {
+        out[0] = 0xF0 | (codepoint >> 18);
+        out[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+        out[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+        out[3] = 0x80 | (codepoint & 0x3F);
+        data_append(out, 4);
+    }
+}
+
+static const char* skip_space(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        ++p;
+    return p;
+}
+
+static bool parse_hex4(const char* p, uint32_t* out) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return false;
+    }
+    *out = value;
+    return true;
+}
+
+/**
+ * Parses a JSON string starting at the opening quote.
+ *
+ * If decode is true, the decoded string is appended to the data buffer.
+ * Returns a pointer past the closing quote, or NULL if the string is
+ * malformed.
+ */
+static const char* parse_string(const char* p, bool decode) {
+    if (*p++ != '"')
+        return NULL;
+    for (;;) {
+        // copy runs of plain characters at once
+        const char* start = p;
+        while (*p != '"' && *p != '\\' && *p != 0)
+            ++p;
+        if (decode)
+            data_append(start, p - start);
+
+        if (*p == '"')
+            return p + 1;
+        if (*p == 0)
+            return NULL;
+
+        // escape sequence
+        ++p;
+        char c = *p++;
+        uint32_t codepoint;
+        switch (c) {
+            case '"': codepoint = '"'; break;
+            case '\\': codepoint = '\\'; break;
+            case '/': codepoint = '/'; break;
+            case 'b': codepoint = '\b'; break;
+            case 'f': codepoint = '\f'; break;
+            case 'n': codepoint = '\n'; break;
+            case 'r': codepoint = '\r'; break;
+            case 't': codepoint = '\t'; break;
+            case 'u':
+                if (!parse_hex4(p, &codepoint))
+                    return NULL;
+                p += 4;
+                // combine surrogate pairs
+                if (codepoint >= 0xD800 && codepoint < 0xDC00 && p[0] == '\\' && p[1] == 'u') {
+                    uint32_t low;
+                    if (parse_hex4(p + 2, &low) && low >= 0xDC00 && low < 0xE000) {
+                        codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                break;
+            default:
+                return NULL;
+        }
+        if (decode)
+            data_append_utf8(codepoint);
+    }
+}
+
+/**
+ * Parses an event line of the form [time, "type", "data"].
+ *
+ * Returns false if the line is malformed. On success, the event's data is
+ * appended to the data buffer if it's an output event.
+ */
+static bool parse_event(double* time) {
+    const char* p = skip_space(line);
+    if (*p++ != '[')
+        return false;
+
+    char* end;
+    *time = strtod(p, &end);
+    if (end == p)
+        return false;
+    p = skip_space(end);
+    if (*p++ != ',')
+        return false;
+
+    p = skip_space(p);
+    bool output = 0 == strncmp(p, "\"o\"", 3);
+    p = parse_string(p, false);
+    if (p == NULL)
+        return false;
+    p = skip_space(p);
+    if (*p++ != ',')
+        return false;
+
+    p = parse_string(skip_space(p), output);
+    if (p == NULL)
+        return false;
+    p = skip_space(p);
+    return *p == ']';
+}
+
+
+
+/*
+ * Output
+ */
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(double time) {
+    double remaining = time - now();
+    if (remaining <= 0)
+        return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)remaining;
+    ts.tv_nsec = (long)((remaining - ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+static void write_all(const char* p, size_t remaining) {
+    while (remaining > 0) {
+        ssize_t step = write(output_fd, p, remaining);
+        if (step <= 0) {
+            if (step == -1 && errno == EINTR)
+                continue;
+            fprintf(stderr, "Failed to write output data!\n");
+            exit(1);
+        }
+        remaining -= step;
+        p += step;
+    }
+}
+
+
+
+/*
+ * Main
+ */
+
+static void usage(void) {
+    fprintf(stderr, "Usage: cli_replay [-max] [-speed N] [-o output] recording.cast\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    const char* input_path = NULL;
+    const char* output_path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-max")) {
+            max_speed = true;
+        } else if (0 == strcmp(argv[i], "-speed") && i + 1 < argc) {
+            speed = atof(argv[++i]);
+            if (speed <= 0) {
+                fprintf(stderr, "Invalid speed: \"%s\"\n", argv[i]);
+                exit(1);
+            }
+        } else if (0 == strcmp(argv[i], "-o") && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (argv[i][0] == '-' || input_path != NULL) {
+            usage();
+        } else {
+            input_path = argv[i];
+        }
+    }
+    if (input_path == NULL)
+        usage();
+
+    FILE* input = fopen(input_path, "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Failed to open \"%s\": %s\n", input_path, strerror(errno));
+        exit(1);
+    }
+
+    if (output_path != NULL) {
+        output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (output_fd == -1) {
+            fprintf(stderr, "Failed to open \"%s\": %s\n", output_path, strerror(errno));
+            exit(1);
+        }
+    }
+
+    if (!read_file(input)) {
+        fprintf(stderr, "Failed to read \"%s\"\n", input_path);
+        exit(1);
+    }
+    fclose(input);
+
+    // The first line is the header. We don't need anything from it.
+    char* p = text;
+    if (!next_line(&p) || skip_space(line)[0] != '{') {
+        fprintf(stderr, "\"%s\" is not an asciicast v2 recording.\n", input_path);
+        exit(1);
+    }
+
+    for (unsigned long number = 2; next_line(&p); ++number) {
+        if (skip_space(line)[0] == 0)
+            continue;
+        double time;
+        size_t offset = data_count;
+        if (!parse_event(&time)) {
+            fprintf(stderr, "Malformed event on line %lu\n", number);
+            exit(1);
+        }
+        if (data_count == offset)
+            continue;
+        events = grow(events, &events_capacity, (event_count + 1) * sizeof(event_t));
+        events[event_count].time = time;
+        events[event_count].offset = offset;
+        events[event_count].count = data_count - offset;
+        ++event_count;
+    }
+    free(text);
+    text = NULL;
+
+    unsigned long frames = 0;
+    unsigned long long bytes = 0;
+    double recorded = 0;
+    double start = now();
+
+    for (size_t i = 0; i < event_count; ++i) {
+        const event_t* event = &events[i];
+        if (!max_speed)
+            sleep_until(start + event->time / speed);
+        write_all(data + event->offset, event->count);
+        ++frames;
+        bytes += event->count;
+        recorded = event->time;
+    }
+
+    double elapsed = now() - start;
+    if (elapsed <= 0)
+        elapsed = 1e-9;
+    fprintf(stderr, "%lu frames, %llu bytes in %.3f s (recorded %.3f s)\n",
+            frames, bytes, elapsed, recorded);
+    fprintf(stderr, "%.1f FPS, %.1f kB/s\n",
+            frames / elapsed, bytes / elapsed / 1000);
+    return 0;
+}
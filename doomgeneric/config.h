@@ -36,8 +36,15 @@
 /* Define to 1 if you have the <memory.h> header file. */
 #undef HAVE_MEMORY_H
 
+/* Define to 1 if you have the `mkstemp' function. */
+#if !defined(_WIN32) && !defined(__onramp__)
+#define HAVE_MKSTEMP 1
+#endif
+
 /* Define to 1 if you have the `mmap' function. */
-#undef HAVE_MMAP
+#if defined(__linux__) && !defined(__onramp__)
+#define HAVE_MMAP 1
+#endif
 
 /* Define to 1 if you have the `sched_setaffinity' function. */
 #undef HAVE_SCHED_SETAFFINITY
@@ -50,6 +50,7 @@
 #include "m_controls.h"
 #include "m_misc.h"
 #include "m_menu.h"
+#include "m_profile.h"
 #include "p_saveg.h"
 
 #include "i_endoom.h"
@@ -127,6 +128,10 @@ char		mapdir[1024];           // directory of development maps
 
 int             show_endoom = 1;
 
+// Most frames to draw per second (-maxfps), or 0 to draw every one.
+static int	maxfps;
+static int	nextframetime;
+
 
 void D_ConnectNetGame(void);
 void D_CheckNetGame(void);
@@ -290,11 +295,13 @@ void D_Display (void)
     // draw pause pic
     if (paused)
     {
+		// the view window is in screen coordinates but patches are
+		// positioned in the original 320x200 coordinates
 		if (automapactive)
 			y = 4;
 		else
-			y = viewwindowy+4;
-		V_DrawPatchDirect(viewwindowx + (scaledviewwidth - 68) / 2, y,
+			y = viewwindowy * ORIGHEIGHT / SCREENHEIGHT + 4;
+		V_DrawPatchDirect((viewwindowx + scaledviewwidth / 2) * ORIGWIDTH / SCREENWIDTH - 34, y,
 							  W_CacheLumpName (DEH_String("M_PAUSE"), PU_CACHE));
     }
 
@@ -412,6 +419,34 @@ boolean D_GrabMouseCallback(void)
     return (gamestate == GS_LEVEL) && !demoplayback && !advancedemo;
 }
 
+//
+// D_FrameDue
+// With -maxfps, tics keep running at the usual rate but the
+//  whole display path is skipped for frames that come too soon
+//  after the last one drawn. There's no point rendering frames
+//  the output can't show.
+//
+static boolean D_FrameDue (void)
+{
+    int		now;
+    int		interval;
+
+    if (!maxfps || timingdemo)
+	return true;
+
+    now = I_GetTimeMS ();
+    if (now - nextframetime < 0)
+	return false;
+
+    // keep to a steady pace, but don't race to catch up
+    //  if we fell behind
+    interval = 1000 / maxfps;
+    nextframetime += interval;
+    if (now - nextframetime >= 0)
+	nextframetime = now + interval;
+    return true;
+}
+
 void doomgeneric_Tick()
 {
 //printf("--------------------------------------------------\n");
@@ -423,7 +458,7 @@ void doomgeneric_Tick()
     S_UpdateSounds (players[consoleplayer].mo);// move positional sounds
 
     // Update display, next frame, with current state.
-    if (screenvisible)
+    if (screenvisible && D_FrameDue ())
     {
         D_Display ();
     }
@@ -434,6 +469,14 @@ void doomgeneric_Tick()
 //
 void D_DoomLoop (void)
 {
+    // End of the D_DoomMain phase
+    M_ProfileEnd ();
+    M_ProfilePrint ();
+
+    // Startup is done. doom-cli takes over the terminal here,
+    // or with -forkserver waits for a session to fork off.
+    DOOMCLI_START_SESSION();
+
     if (bfgedition &&
         (demorecording || (gameaction == ga_playdemo) || netgame))
     {
@@ -1189,6 +1232,9 @@ void D_DoomMain (void)
     DEH_printf("Z_Init: Init zone memory allocation daemon. \n");
     Z_Init ();
 
+    M_ProfileInit ();
+    M_ProfileBegin ("D_DoomMain");
+
 #ifdef FEATURE_MULTIPLAYER
     //!
     // @category net
@@ -1362,19 +1408,25 @@ void D_DoomMain (void)
     
     // init subsystems
     DEH_printf("V_Init: allocate screens.\n");
+    M_ProfileBegin ("V_Init");
     V_Init ();
+    M_ProfileEnd ();
 
     // Load configuration files before initialising other subsystems.
     DEH_printf("M_LoadDefaults: Load system defaults.\n");
+    M_ProfileBegin ("M_LoadDefaults");
     M_SetConfigFilenames("default.cfg", PROGRAM_PREFIX "doom.cfg");
     D_BindVariables();
     M_LoadDefaults();
+    M_ProfileEnd ();
 
     // Save configuration at exit.
     I_AtExit(M_SaveDefaults, false);
 
     // Find main IWAD file and load it.
+    M_ProfileBegin ("D_FindIWAD");
     iwadfile = D_FindIWAD(IWAD_MASK_DOOM, &gamemission);
+    M_ProfileEnd ();
 
     // None found?
 
@@ -1387,6 +1439,7 @@ void D_DoomMain (void)
     modifiedgame = false;
 
     DEH_printf("W_Init: Init WADfiles.\n");
+    M_ProfileBegin ("W_Init");
     D_AddFile(iwadfile);
 #if ORIGCODE
     numiwadlumps = numlumps;
@@ -1525,6 +1578,7 @@ void D_DoomMain (void)
 
     // Generate the WAD hash table.  Speed things up a bit.
     W_GenerateHashTable();
+    M_ProfileEnd ();
 
     // Load DEHACKED lumps from WAD files - but only if we give the right
     // command line parameter.
@@ -1619,11 +1673,13 @@ void D_DoomMain (void)
     }
 
     DEH_printf("I_Init: Setting up machine state.\n");
+    M_ProfileBegin ("I_Init");
     I_CheckIsScreensaver();
     I_InitTimer();
     I_InitJoystick();
     I_InitSound(true);
     I_InitMusic();
+    M_ProfileEnd ();
 
 #ifdef FEATURE_MULTIPLAYER
     printf ("NET_Init: Init network subsystem.\n");
@@ -1702,6 +1758,23 @@ void D_DoomMain (void)
 	timelimit = 20;
     }
 
+    //!
+    // @arg <n>
+    // @category video
+    //
+    // Draw at most n frames per second. The game still runs at 35
+    // tics per second; frames in between are skipped entirely.
+    //
+
+    p = M_CheckParmWithArgs("-maxfps", 1);
+
+    if (p)
+    {
+	maxfps = atoi(myargv[p+1]);
+	if (maxfps < 1)
+	    I_Error("Invalid -maxfps: %s", myargv[p+1]);
+    }
+
     //!
     // @arg [<x> <y> | <xy>]
     // @vanilla
@@ -1769,27 +1842,41 @@ void D_DoomMain (void)
     }
 
     DEH_printf("M_Init: Init miscellaneous info.\n");
+    M_ProfileBegin ("M_Init");
     M_Init ();
+    M_ProfileEnd ();
 
     DEH_printf("R_Init: Init DOOM refresh daemon - ");
+    M_ProfileBegin ("R_Init");
     R_Init ();
+    M_ProfileEnd ();
 
     DEH_printf("\nP_Init: Init Playloop state.\n");
+    M_ProfileBegin ("P_Init");
     P_Init ();
+    M_ProfileEnd ();
 
     DEH_printf("S_Init: Setting up sound.\n");
+    M_ProfileBegin ("S_Init");
     S_Init (sfxVolume * 8, musicVolume * 8);
+    M_ProfileEnd ();
 
     DEH_printf("D_CheckNetGame: Checking network game status.\n");
+    M_ProfileBegin ("D_CheckNetGame");
     D_CheckNetGame ();
+    M_ProfileEnd ();
 
     PrintGameVersion();
 
     DEH_printf("HU_Init: Setting up heads up display.\n");
+    M_ProfileBegin ("HU_Init");
     HU_Init ();
+    M_ProfileEnd ();
 
     DEH_printf("ST_Init: Init status bar.\n");
+    M_ProfileBegin ("ST_Init");
     ST_Init ();
+    M_ProfileEnd ();
 
     // If Doom II without a MAP01 lump, this is a store demo.
     // Moved this here so that MAP01 isn't constantly looked up
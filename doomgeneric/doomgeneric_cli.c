@@ -14,18 +14,44 @@
 #include <time.h>
 #include <unistd.h>
 
+// Onramp doesn't have POSIX shared memory. We fall back to transmitting kitty
+// graphics directly through the terminal.
+#ifndef __onramp__
+    #define DOOMCLI_HAVE_SHM
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// Onramp doesn't have sockets either, so there's no spectator server.
+#ifndef __onramp__
+    #define DOOMCLI_HAVE_SOCKETS
+    #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+#endif
+
+// Onramp doesn't have threads either, so the renderer runs on one thread.
+#ifndef __onramp__
+    #define DOOMCLI_HAVE_THREADS
+    #include <pthread.h>
+#endif
+
 #include "cli_data.h"
 #include "i_video.h"
 #include "doomgeneric.h"
 #include "doomkeys.h"
+#include "doomstat.h"
 #include "m_argv.h"
-
-#if DOOMGENERIC_RESX != 320
-    #error "ERROR: Invalid DOOMGENERIC_RESX. It must be 320."
-#endif
-#if DOOMGENERIC_RESY != 200
-    #error "ERROR: Invalid DOOMGENERIC_RESY. It must be 200."
-#endif
+#include "m_menu.h"
+#include "r_data.h"
+#include "r_main.h"
+#include "r_draw.h"
+#include "r_walk.h"
+#include "w_wad.h"
+#include "z_zone.h"
 
 //#define DEBUG_FIXED_TICKRATE
 
@@ -45,6 +71,14 @@ static int dest_width;
 static int dest_height;
 static uint32_t* dest_buffer;
 
+// the size the game renders at. zero means match the destination size.
+static int render_width;
+static int render_height;
+
+#ifdef DOOMCLI_HAVE_THREADS
+static pthread_t main_thread;
+#endif
+
 static bool synchronized_updates;
 
 typedef enum {
@@ -52,6 +86,7 @@ typedef enum {
     cli_mode_quadrant,
     cli_mode_half,
     cli_mode_space,
+    cli_mode_kitty,
 } cli_mode_t;
 
 static cli_mode_t cli_mode = cli_mode_sextant;
@@ -606,20 +641,7 @@ static int color_8bit(int red, int green, int blue) {
 }
 
 // Outputs a background color.
-static void output_bg_color(int x, int y, int red, int green, int blue) {
-    if (noise_enabled) {
-        uint32_t noise_color = NOISE_SAMPLE(x, y);
-        red += (noise_color >> 16 & 0xff) - 128;
-        green += ((noise_color >> 8) & 0xff) - 128;
-        blue += ((noise_color) & 0xff) - 128;
-
-        /*
-        red = ((noise_color >> 16) & 0xff);
-        green = ((noise_color >> 8) & 0xff);
-        blue = ((noise_color) & 0xff);
-        */
-    }
-
+static void output_bg_color(int red, int green, int blue) {
     switch (cli_colors) {
         case cli_colors_24bit:
             buffer_append_format("\033[48;2;%u;%u;%um", red, green, blue);
@@ -638,33 +660,9 @@ static void output_bg_color(int x, int y, int red, int green, int blue) {
 
 // Outputs both background and foreground colors.
 static void output_colors(
-        int x, int y,
         int fg_red, int fg_green, int fg_blue,
         int bg_red, int bg_green, int bg_blue)
 {
-    // TODO this applies noise per character which is not what we should be
-    // doing. We would get much better noise quality if we applied it per
-    // pixel.
-    if (noise_enabled) {
-        uint32_t noise_color = NOISE_SAMPLE(x, y);
-
-        fg_red += ((noise_color >> 16) & 0xff) - 128;
-        bg_red += ((noise_color >> 16) & 0xff) - 128;
-        fg_green += ((noise_color >> 8) & 0xff) - 128;
-        bg_green += ((noise_color >> 8) & 0xff) - 128;
-        fg_blue += ((noise_color) & 0xff) - 128;
-        bg_blue += ((noise_color) & 0xff) - 128;
-
-        /*
-        fg_red = (noise_color & 0xff);
-        bg_red = (noise_color & 0xff);
-        fg_green = ((noise_color >> 8) & 0xff);
-        bg_green = ((noise_color >> 8) & 0xff);
-        fg_blue = ((noise_color >> 16) & 0xff);
-        bg_blue = ((noise_color >> 16) & 0xff);
-        */
-    }
-
     #define INT_NAME(x) x  // TODO remove INT_NAME()
 
     char buf[256];
@@ -718,6 +716,192 @@ static void output_newline(void) {
 
 
 
+/*
+ * Cells
+ *
+ * The draw functions don't output escape codes directly. They fit each
+ * character cell of the frame to a glyph and its colors in the cells grid,
+ * and the grid is then encoded separately. This lets us compare the frame to
+ * what the terminal is already showing.
+ */
+
+#define CELL_BG 1  // the cell sets a background color
+#define CELL_FG 2  // the cell sets a foreground color
+
+typedef struct cell_t {
+    const char* glyph;
+    uint8_t colors;     // CELL_BG and CELL_FG flags
+    int16_t fg[3];      // red, green, blue, with noise applied
+    int16_t bg[3];
+} cell_t;
+
+// The grid is columns wide and cell_rows high.
+static cell_t* cells;
+static int cell_rows;
+
+static inline void apply_noise(int x, int y, int* red, int* green, int* blue) {
+    uint32_t noise_color = NOISE_SAMPLE(x, y);
+    *red += ((noise_color >> 16) & 0xff) - 128;
+    *green += ((noise_color >> 8) & 0xff) - 128;
+    *blue += ((noise_color) & 0xff) - 128;
+}
+
+// Fits a cell that is drawn with only a background color.
+static void fit_bg(cell_t* cell, int x, int y,
+        int red, int green, int blue, const char* glyph)
+{
+    if (noise_enabled)
+        apply_noise(x, y, &red, &green, &blue);
+    cell->glyph = glyph;
+    cell->colors = CELL_BG;
+    cell->bg[0] = red;
+    cell->bg[1] = green;
+    cell->bg[2] = blue;
+}
+
+// Fits a cell that is drawn with both foreground and background colors.
+static void fit_colors(cell_t* cell, int x, int y,
+        int fg_red, int fg_green, int fg_blue,
+        int bg_red, int bg_green, int bg_blue,
+        const char* glyph)
+{
+    // TODO this applies noise per character which is not what we should be
+    // doing. We would get much better noise quality if we applied it per
+    // pixel.
+    if (noise_enabled) {
+        apply_noise(x, y, &fg_red, &fg_green, &fg_blue);
+        apply_noise(x, y, &bg_red, &bg_green, &bg_blue);
+    }
+    cell->glyph = glyph;
+    cell->colors = CELL_FG | CELL_BG;
+    cell->fg[0] = fg_red;
+    cell->fg[1] = fg_green;
+    cell->fg[2] = fg_blue;
+    cell->bg[0] = bg_red;
+    cell->bg[1] = bg_green;
+    cell->bg[2] = bg_blue;
+}
+
+// Fits a cell that is drawn in the terminal's default colors.
+static void fit_glyph(cell_t* cell, const char* glyph) {
+    cell->glyph = glyph;
+    cell->colors = 0;
+}
+
+static void output_cell_colors(const cell_t* cell) {
+    if (cell->colors & CELL_FG) {
+        output_colors(
+                cell->fg[0], cell->fg[1], cell->fg[2],
+                cell->bg[0], cell->bg[1], cell->bg[2]);
+    } else if (cell->colors & CELL_BG) {
+        output_bg_color(cell->bg[0], cell->bg[1], cell->bg[2]);
+    }
+}
+
+static void output_cell(const cell_t* cell) {
+    output_cell_colors(cell);
+    buffer_append_cstr(cell->glyph);
+}
+
+
+
+/*
+ * Temporal stability
+ *
+ * Each frame we fit every character cell independently. Tiny changes in
+ * lighting (and the rotating noise) flip masks and colors all over the screen
+ * even when nothing is really moving, which makes the output much larger and
+ * much less compressible.
+ *
+ * In stable mode we remember the fit we used for each cell in the previous
+ * frame. We keep it unless the new fit matches the new pixels better by at
+ * least the stability margin. We also stop rotating the noise textures so the
+ * dither pattern is fixed in place.
+ */
+
+static bool stable_enabled = false;
+
+// The margin is roughly the average per-channel color difference (0-255) a
+// cell must improve by before we replace it.
+static int stable_margin = 12;
+
+typedef struct cell_fit_t {
+    bool valid;
+    uint8_t index;      // mask; bit i set means pixel i uses the foreground
+    uint8_t fg[3];      // red, green, blue
+    uint8_t bg[3];
+} cell_fit_t;
+
+static cell_fit_t* stable_cells;
+
+// Returns the error of drawing the given pixels with the given fit.
+static uint32_t cell_fit_error(uint8_t** pixels, int count, int index,
+        uint32_t fg_red, uint32_t fg_green, uint32_t fg_blue,
+        uint32_t bg_red, uint32_t bg_green, uint32_t bg_blue)
+{
+    uint32_t error = 0;
+    for (int i = 0; i < count; ++i) {
+        const uint8_t* pixel = pixels[i];
+        bool fg = (index >> i) & 1;
+        int rd = ((int)pixel[2] - (int)(fg ? fg_red : bg_red)) * DIFF_WEIGHT_RED;
+        int gd = ((int)pixel[1] - (int)(fg ? fg_green : bg_green)) * DIFF_WEIGHT_GREEN;
+        int bd = ((int)pixel[0] - (int)(fg ? fg_blue : bg_blue)) * DIFF_WEIGHT_BLUE;
+        error += rd * rd + gd * gd + bd * bd;
+    }
+    return error;
+}
+
+/**
+ * Applies hysteresis to the fit of one cell.
+ *
+ * pixels are the cell's pixels in mask bit order. On input, index and the
+ * colors are this frame's fit; on output they are the fit to draw, which is
+ * either the same or the one we drew last frame.
+ */
+static void stabilize_cell(int cell, uint8_t** pixels, int count, int* index,
+        uint32_t* fg_red, uint32_t* fg_green, uint32_t* fg_blue,
+        uint32_t* bg_red, uint32_t* bg_green, uint32_t* bg_blue)
+{
+    cell_fit_t* prev = &stable_cells[cell];
+
+    if (prev->valid) {
+        uint32_t new_error = cell_fit_error(pixels, count, *index,
+                *fg_red, *fg_green, *fg_blue, *bg_red, *bg_green, *bg_blue);
+        uint32_t old_error = cell_fit_error(pixels, count, prev->index,
+                prev->fg[0], prev->fg[1], prev->fg[2],
+                prev->bg[0], prev->bg[1], prev->bg[2]);
+
+        // The margin is scaled the same way as the error: weighted, squared
+        // and summed over the cell's pixels.
+        uint32_t margin = stable_margin * stable_margin * count *
+                (DIFF_WEIGHT_RED * DIFF_WEIGHT_RED +
+                 DIFF_WEIGHT_GREEN * DIFF_WEIGHT_GREEN +
+                 DIFF_WEIGHT_BLUE * DIFF_WEIGHT_BLUE);
+
+        if (old_error <= new_error + margin) {
+            *index = prev->index;
+            *fg_red = prev->fg[0];
+            *fg_green = prev->fg[1];
+            *fg_blue = prev->fg[2];
+            *bg_red = prev->bg[0];
+            *bg_green = prev->bg[1];
+            *bg_blue = prev->bg[2];
+            return;
+        }
+    }
+
+    prev->valid = true;
+    prev->index = *index;
+    prev->fg[0] = *fg_red;
+    prev->fg[1] = *fg_green;
+    prev->fg[2] = *fg_blue;
+    prev->bg[0] = *bg_red;
+    prev->bg[1] = *bg_green;
+    prev->bg[2] = *bg_blue;
+}
+
+
+
 /*
  * Rendering
  */
@@ -732,41 +916,64 @@ static void start_row() {
 
 static void draw_space() {
     uint32_t* dest_pixel = dest_buffer;
+    cell_t* cell = cells;
     for (int y = 0; y < dest_height; ++y) {
-        start_row();
+        DOOMCLI_READ_INPUT();
         for (int x = 0; x < dest_width; ++x) {
             uint8_t* pixel = (uint8_t*)dest_pixel;
-            output_bg_color(x, y, pixel[2], pixel[1], pixel[0]);
+            if (stable_enabled) {
+                // a single pixel drawn with the background color
+                int index = 0;
+                uint32_t fg_red = 0, fg_green = 0, fg_blue = 0;
+                uint32_t bg_red = pixel[2], bg_green = pixel[1], bg_blue = pixel[0];
+                stabilize_cell(y * dest_width + x, &pixel, 1, &index,
+                        &fg_red, &fg_green, &fg_blue, &bg_red, &bg_green, &bg_blue);
+                fit_bg(cell, x, y, bg_red, bg_green, bg_blue, " ");
+            } else {
+                fit_bg(cell, x, y, pixel[2], pixel[1], pixel[0], " ");
+            }
             //printf("\033[48;5;%um ", 16 + (pixel[0] / 43) + (pixel[1] / 43) * 6 + (pixel[2] / 43) * 36);
-            buffer_append_literal(" ");
+            ++cell;
             ++dest_pixel;
         }
-        output_newline();
     }
 }
 
 static void draw_half() {
     uint32_t* top = dest_buffer;
     uint32_t* bot = dest_buffer + dest_width;
+    cell_t* cell = cells;
 
     for (int y = 0; y < dest_height; y += 2) {
-        start_row();
+        DOOMCLI_READ_INPUT();
         for (int x = 0; x < dest_width; ++x) {
             //printf("\033[48;2;%u;%u;%um ", pixel[2], pixel[1], pixel[0]);
             //printf("\033[48;5;%um ", 16 + (pixel[0] / 43) + (pixel[1] / 43) * 6 + (pixel[2] / 43) * 36);
 
-            output_colors(x, y,
-                    ((uint8_t*)top)[2], ((uint8_t*)top)[1], ((uint8_t*)top)[0],
-                    ((uint8_t*)bot)[2], ((uint8_t*)bot)[1], ((uint8_t*)bot)[0]);
-            if (cli_mode == cli_mode_half) {
-                buffer_append_literal(UPPER_HALF);
+            if (stable_enabled) {
+                // the top pixel is the foreground, the bottom the background
+                uint8_t* pixels[2] = {(uint8_t*)top, (uint8_t*)bot};
+                int index = 1;
+                uint32_t fg_red = pixels[0][2], fg_green = pixels[0][1], fg_blue = pixels[0][0];
+                uint32_t bg_red = pixels[1][2], bg_green = pixels[1][1], bg_blue = pixels[1][0];
+                stabilize_cell((y >> 1) * dest_width + x, pixels, 2, &index,
+                        &fg_red, &fg_green, &fg_blue, &bg_red, &bg_green, &bg_blue);
+                fit_colors(cell, x, y,
+                        fg_red, fg_green, fg_blue,
+                        bg_red, bg_green, bg_blue,
+                        UPPER_HALF);
+            } else {
+                fit_colors(cell, x, y,
+                        ((uint8_t*)top)[2], ((uint8_t*)top)[1], ((uint8_t*)top)[0],
+                        ((uint8_t*)bot)[2], ((uint8_t*)bot)[1], ((uint8_t*)bot)[0],
+                        UPPER_HALF);
             }
 
+            ++cell;
             ++top;
             ++bot;
         }
 
-        output_newline();
         top += dest_width;
         bot += dest_width;
     }
@@ -775,9 +982,10 @@ static void draw_half() {
 static void draw_quadrant() {
     uint32_t* top = dest_buffer;
     uint32_t* bot = dest_buffer + dest_width;
+    cell_t* cell = cells;
 
     for (int y = 0; y < dest_height; y += 2) {
-        start_row();
+        DOOMCLI_READ_INPUT();
         for (int x = 0; x < dest_width; x += 2) {
 
             // get pixels
@@ -913,21 +1121,26 @@ static void draw_quadrant() {
                     ((uint8_t*)bot)[2], ((uint8_t*)bot)[1], ((uint8_t*)bot)[0]);
                     */
 
+            if (stable_enabled) {
+                uint8_t* pixels[4] = {tl, tr, bl, br};
+                stabilize_cell((y >> 1) * (dest_width >> 1) + (x >> 1), pixels, 4, &index,
+                        &fg_red, &fg_green, &fg_blue, &bg_red, &bg_green, &bg_blue);
+            }
+
             if (index == 0) {
-                output_bg_color(x, y, bg_red, bg_green, bg_blue);
-                buffer_append_literal(" ");
+                fit_bg(cell, x, y, bg_red, bg_green, bg_blue, " ");
             } else {
-                output_colors(x, y,
+                fit_colors(cell, x, y,
                         fg_red, fg_green, fg_blue,
-                        bg_red, bg_green, bg_blue);
-                buffer_append_cstr(quadrants[index]);
+                        bg_red, bg_green, bg_blue,
+                        quadrants[index]);
             }
 
+            ++cell;
             top += 2;
             bot += 2;
         }
 
-        output_newline();
         top += dest_width;
         bot += dest_width;
     }
@@ -938,9 +1151,10 @@ static void draw_sextant_bw() {
     uint32_t* top = dest_buffer;
     uint32_t* mid = top + dest_width;
     uint32_t* bot = mid + dest_width;
+    cell_t* cell = cells;
 
     for (int y = 0; y < dest_height; y += 3) {
-        start_row();
+        DOOMCLI_READ_INPUT();
         for (int x = 0; x < dest_width; x += 2) {
 
             // get pixels
@@ -985,14 +1199,14 @@ static void draw_sextant_bw() {
                 index = (~index) & 0x3f;
             }
 
-            buffer_append_cstr(sextants[index]);
+            fit_glyph(cell, sextants[index]);
 
+            ++cell;
             top += 2;
             mid += 2;
             bot += 2;
         }
 
-        output_newline();
         top += dest_width << 1;
         mid += dest_width << 1;
         bot += dest_width << 1;
@@ -1004,9 +1218,10 @@ static void draw_sextant() {
     uint32_t* top = dest_buffer;
     uint32_t* mid = top + dest_width;
     uint32_t* bot = mid + dest_width;
+    cell_t* cell = cells;
 
     for (int y = 0; y < dest_height; y += 3) {
-        start_row();
+        DOOMCLI_READ_INPUT();
         for (int x = 0; x < dest_width; x += 2) {
 
             // get pixels
@@ -1181,25 +1396,30 @@ static void draw_sextant() {
                     ((uint8_t*)bot)[2], ((uint8_t*)bot)[1], ((uint8_t*)bot)[0]);
                     */
 
+            if (stable_enabled) {
+                uint8_t* pixels[6] = {tl, tr, ml, mr, bl, br};
+                stabilize_cell((y / 3) * (dest_width >> 1) + (x >> 1), pixels, 6, &index,
+                        &fg_red, &fg_green, &fg_blue, &bg_red, &bg_green, &bg_blue);
+            }
+
 //if (x < 10){
             if (index == 0) {
-                output_bg_color(x, y, bg_red, bg_green, bg_blue);
-                buffer_append_literal(" ");
+                fit_bg(cell, x, y, bg_red, bg_green, bg_blue, " ");
             } else {
                 //buffer_append_format("\033[0m%u",index);
-                output_colors(x, y,
+                fit_colors(cell, x, y,
                         fg_red, fg_green, fg_blue,
-                        bg_red, bg_green, bg_blue);
-                buffer_append_cstr(sextants[index]);
+                        bg_red, bg_green, bg_blue,
+                        sextants[index]);
             }
 //}
 
+            ++cell;
             top += 2;
             mid += 2;
             bot += 2;
         }
 
-        output_newline();
         top += dest_width << 1;
         mid += dest_width << 1;
         bot += dest_width << 1;
@@ -1207,138 +1427,1516 @@ static void draw_sextant() {
 //printf("%s %i  done\n",__func__, DG_GetTicksMs());
 }
 
+// Outputs the whole cell grid. The cursor must be at the top left.
+static void encode_frame(void) {
+    const cell_t* cell = cells;
+    for (int row = 0; row < cell_rows; ++row) {
+        start_row();
+        for (int column = 0; column < columns; ++column)
+            output_cell(cell++);
+        output_newline();
+    }
+}
+
 
 
 /*
- * Callbacks
+ * Partial updates
+ *
+ * With an update threshold we don't redraw the whole screen every frame.
+ * Instead we keep a model of what the terminal is showing and only send the
+ * cells whose glyph changed or whose colors moved by more than the threshold.
+ *
+ * A cell under the threshold keeps whatever the terminal already shows, so
+ * small errors could otherwise linger forever. To bound them we also refresh
+ * one row per frame in rotation, sending every cell in it that differs from
+ * the frame at all.
  */
 
-static void setup_io(void) {
+// Negative means disabled; we redraw everything every frame.
+static int update_threshold = -1;
 
-    // TODO need to set up signals to reset termios
+typedef struct display_t {
+    cell_t* cells;      // what the terminal is currently showing
+    bool valid;         // false until we've sent a full frame
+    int refresh_row;    // the next row to refresh
+} display_t;
 
-    // unbuffered
-    setvbuf(stdin, NULL, _IONBF, BUFSIZ);
+// the local terminal
+static display_t display;
 
-    // non-blocking
-    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+/*
+ * The redmean approximation of perceptual color difference gives roughly 9
+ * times the square of the per-channel difference for gray changes. We scale
+ * the threshold by this so it's roughly in channel units (0-255).
+ *
+ *     https://www.compuphase.com/cmetric.htm
+ */
+#define COLOR_DISTANCE_SCALE 9
+
+// Returns the squared perceptual distance between two colors.
+static uint32_t color_distance(const int16_t* a, const int16_t* b) {
+    int rmean = clamp((a[0] + b[0]) >> 1, 0, 255);
+    int dr = a[0] - b[0];
+    int dg = a[1] - b[1];
+    int db = a[2] - b[2];
+    return (((512 + rmean) * dr * dr) >> 8) + 4 * dg * dg +
+            (((767 - rmean) * db * db) >> 8);
+}
 
-#ifndef DEBUG_FIXED_TICKRATE
-    // non-canonical, no echo
-    struct termios termios;
-    tcgetattr(STDIN_FILENO, &termios);
-    termios.c_lflag &= ~(ECHO | ICANON);
-    //cfmakeraw(&termios);
-    tcsetattr(STDIN_FILENO, TCSANOW, &termios);
-#endif
+// Returns true if the cell must be sent to replace what is shown. The limit
+// is a squared color distance; 0 means any change at all.
+static bool cell_changed(const cell_t* shown, const cell_t* cell, uint32_t limit) {
+    if (shown->colors != cell->colors)
+        return true;
+    if (shown->glyph != cell->glyph && 0 != strcmp(shown->glyph, cell->glyph))
+        return true;
+    if ((cell->colors & CELL_FG) && color_distance(shown->fg, cell->fg) > limit)
+        return true;
+    if ((cell->colors & CELL_BG) && color_distance(shown->bg, cell->bg) > limit)
+        return true;
+    return false;
+}
 
+// Returns true if the terminal's current attributes already draw the cell in
+// its colors. The current cell holds the last colors we set.
+static bool cell_colors_set(const cell_t* current, const cell_t* cell) {
+    if (cell->colors & CELL_FG) {
+        if (!(current->colors & CELL_FG) || 0 != memcmp(current->fg, cell->fg, sizeof(cell->fg)))
+            return false;
+    }
+    if (cell->colors & CELL_BG) {
+        if (!(current->colors & CELL_BG) || 0 != memcmp(current->bg, cell->bg, sizeof(cell->bg)))
+            return false;
+    }
+    return true;
 }
 
-static void parse_cli_options() {
-    int arg = M_CheckParmWithArgs("-charset", 1);
-    if (arg)
-    {
-        const char* charset = myargv[arg + 1];
-        if (0 == strcmp(charset, "sextant")) {
-            cli_mode = cli_mode_sextant;
-        } else if (0 == strcmp(charset, "quadrant")) {
-            cli_mode = cli_mode_quadrant;
-        } else if (0 == strcmp(charset, "half")) {
-            cli_mode = cli_mode_half;
-        } else if (0 == strcmp(charset, "space")) {
-            cli_mode = cli_mode_space;
-        } else {
-            fprintf(stderr, "Unrecognized charset option: \"%s\"\n", charset);
-            abort();
-        }
+// Records that a full frame was just sent to the display.
+static void display_keyframe(display_t* display) {
+    memcpy(display->cells, cells, sizeof(cell_t) * columns * cell_rows);
+    display->valid = true;
+}
+
+// Outputs only the cells that need to change on the display.
+static void encode_changes(display_t* display, int threshold) {
+    uint32_t limit = threshold * threshold * COLOR_DISTANCE_SCALE;
+    const cell_t* cell = cells;
+    cell_t* shown = display->cells;
+    cell_t current = {0};
+    int cursor_row = -1;
+    int cursor_column = -1;
+
+    if (cli_colors == cli_colors_3bit) {
+        // send bold, hopefully the terminal interprets it as bright
+        buffer_append_literal("\033[1m");
     }
 
-    arg = M_CheckParmWithArgs("-color", 1);
-    if (arg)
-    {
-        const char* color = myargv[arg + 1];
-        if (0 == strcmp(color, "24bit")) {
-            cli_colors = cli_colors_24bit;
-        } else if (0 == strcmp(color, "8bit")) {
-            cli_colors = cli_colors_8bit;
-        } else if (0 == strcmp(color, "4bit")) {
-            cli_colors = cli_colors_4bit;
-        } else if (0 == strcmp(color, "3bit")) {
-            cli_colors = cli_colors_3bit;
-        } else if (0 == strcmp(color, "light")) {
-            cli_colors = cli_colors_light;
-        } else if (0 == strcmp(color, "dark")) {
-            cli_colors = cli_colors_dark;
-        } else {
-            fprintf(stderr, "Unrecognized color option: \"%s\"\n", color);
-            abort();
+    for (int row = 0; row < cell_rows; ++row) {
+        DOOMCLI_READ_INPUT();
+        uint32_t row_limit = row == display->refresh_row ? 0 : limit;
+
+        for (int column = 0; column < columns; ++column, ++cell, ++shown) {
+            if (!cell_changed(shown, cell, row_limit))
+                continue;
+
+            if (row != cursor_row || column != cursor_column)
+                buffer_append_format("\033[%i;%iH", row + 1, column + 1);
+
+            if (!cell_colors_set(&current, cell)) {
+                output_cell_colors(cell);
+                if (cell->colors & CELL_FG)
+                    memcpy(current.fg, cell->fg, sizeof(cell->fg));
+                if (cell->colors & CELL_BG)
+                    memcpy(current.bg, cell->bg, sizeof(cell->bg));
+                current.colors |= cell->colors;
+            }
+            buffer_append_cstr(cell->glyph);
+            *shown = *cell;
+
+            // after the last column the cursor is pending a wrap, so we
+            // don't know where it is
+            cursor_row = row;
+            cursor_column = column + 1;
+            if (cursor_column == columns)
+                cursor_row = -1;
         }
     }
 
-    arg = M_CheckParmWithArgs("-filter", 1);
-    if (arg)
-    {
-        const char* filter = myargv[arg + 1];
-        if (0 == strcmp(filter, "box")) {
-            // TODO
-        } else if (0 == strcmp(filter, "nearest")) {
-            // TODO
-        } else {
-            // TODO
-        }
-        fprintf(stderr, "Filter option is not yet implemented.\n");
-        abort();
+    buffer_append_literal("\033[0m");
+    display->refresh_row = (display->refresh_row + 1) % cell_rows;
+}
+
+
+
+/*
+ * Kitty graphics
+ *
+ * In kitty mode we don't draw with characters at all. Instead we send the
+ * whole frame as an image using the kitty graphics protocol:
+ *
+ *     https://sw.kovidgoyal.net/kitty/graphics-protocol/
+ *
+ * If the terminal is on the same machine, we write the pixels to a POSIX
+ * shared memory object and only send its name (t=s). The terminal reads and
+ * unlinks it. Otherwise we have to send the pixels base64 encoded in chunks
+ * (t=d) which is many times larger than any of the character modes.
+ *
+ * We always use the same image and placement ids so the terminal replaces the
+ * previous frame in place instead of stacking images.
+ */
+
+typedef enum {
+    kitty_transfer_shm = 1,
+    kitty_transfer_direct,
+} kitty_transfer_t;
+
+static kitty_transfer_t kitty_transfer;
+
+// the frame expanded to 24-bit RGB, the format we send to the terminal. With
+// shared memory it's expanded straight into the shared object; kitty_rgb is
+// only allocated for direct transmission.
+static uint8_t* kitty_rgb;
+static size_t kitty_rgb_size;
+
+// number of character rows covered by the image
+static int kitty_rows;
+
+#define KITTY_CHUNK_SIZE 4096  // maximum base64 payload per escape code
+
+#ifdef DOOMCLI_HAVE_SHM
+// The terminal is supposed to unlink each shared memory object after reading
+// it. In case it doesn't (e.g. it doesn't support kitty graphics at all) we
+// unlink old objects ourselves so we don't fill up /dev/shm.
+#define KITTY_SHM_KEEP 4
+static uint32_t kitty_shm_serial;
+#endif
+
+static void buffer_append_base64(const uint8_t* bytes, size_t count) {
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char out[4];
+    while (count >= 3) {
+        out[0] = digits[bytes[0] >> 2];
+        out[1] = digits[((bytes[0] & 3) << 4) | (bytes[1] >> 4)];
+        out[2] = digits[((bytes[1] & 15) << 2) | (bytes[2] >> 6)];
+        out[3] = digits[bytes[2] & 63];
+        buffer_append(out, 4);
+        bytes += 3;
+        count -= 3;
     }
+    if (count > 0) {
+        uint8_t b1 = count > 1 ? bytes[1] : 0;
+        out[0] = digits[bytes[0] >> 2];
+        out[1] = digits[((bytes[0] & 3) << 4) | (b1 >> 4)];
+        out[2] = count > 1 ? digits[(b1 & 15) << 2] : '=';
+        out[3] = '=';
+        buffer_append(out, 4);
+    }
+}
 
-    arg = M_CheckParmWithArgs("-noise", 1);
-    if (arg)
-    {
-        const char* noise = myargv[arg + 1];
-        if (0 == strcmp(noise, "on")) {
-            noise_enabled = true;
-        } else if (0 == strcmp(noise, "off")) {
-            noise_enabled = false;
-        } else {
-            fprintf(stderr, "Unrecognized noise option: \"%s\"\n", noise);
-            abort();
-        }
+// Expands the paletted frame to RGB. This is the same palette lookup as the
+// resampling in DG_DrawFrame(), just without scaling and in the byte order
+// kitty wants.
+static void kitty_expand_frame(uint8_t* out) {
+    const byte* in = I_VideoBuffer;
+    for (int i = 0; i < SCREENWIDTH * SCREENHEIGHT; ++i) {
+        const struct color* c = &colors[*in++];
+        *out++ = c->r;
+        *out++ = c->g;
+        *out++ = c->b;
     }
+}
 
-    arg = M_CheckParmWithArgs("-noise-speed", 1);
-    if (arg)
-    {
-        noise_speed = atoi(myargv[arg + 1]);
+static void kitty_append_keys(const char* medium) {
+    buffer_append_format("\033_Ga=T,f=24,s=%i,v=%i,t=%s,i=1,p=1,c=%i,r=%i,C=1,q=2",
+            SCREENWIDTH, SCREENHEIGHT, medium, columns, kitty_rows);
+}
+
+#ifdef DOOMCLI_HAVE_SHM
+static void kitty_shm_name(char* name, size_t size, uint32_t serial) {
+    snprintf(name, size, "/doom-cli-%i-%u", (int)getpid(), serial);
+}
+
+static void kitty_shm_cleanup(void) {
+    char name[64];
+    for (uint32_t i = 1; i <= KITTY_SHM_KEEP && i <= kitty_shm_serial; ++i) {
+        kitty_shm_name(name, sizeof(name), kitty_shm_serial - i);
+        shm_unlink(name);
     }
+}
 
-    arg = M_CheckParmWithArgs("-noise-strength", 1);
-    if (arg)
-    {
-        // TODO
-        fprintf(stderr, "Noise strength option is not yet implemented.\n");
-        abort();
+// Expands the frame into a new shared memory object and sends its name.
+// Returns false if shared memory isn't working so the caller can fall back
+// to direct transmission.
+static bool kitty_send_shm(void) {
+    char name[64];
+
+    if (kitty_shm_serial >= KITTY_SHM_KEEP) {
+        kitty_shm_name(name, sizeof(name), kitty_shm_serial - KITTY_SHM_KEEP);
+        shm_unlink(name);
     }
 
-    arg = M_CheckParmWithArgs("-columns", 1);
-    if (arg)
-    {
-        columns = atoi(myargv[arg + 1]);
+    kitty_shm_name(name, sizeof(name), kitty_shm_serial);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1)
+        return false;
+    if (ftruncate(fd, kitty_rgb_size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* map = mmap(NULL, kitty_rgb_size, PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        shm_unlink(name);
+        return false;
     }
+    kitty_expand_frame(map);
+    munmap(map, kitty_rgb_size);
+    ++kitty_shm_serial;
+
+    kitty_append_keys("s");
+    buffer_append_literal(";");
+    buffer_append_base64((const uint8_t*)name, strlen(name));
+    buffer_append_literal("\033\\");
+    return true;
+}
+#endif
 
-    if (cli_colors == cli_colors_dark || cli_colors == cli_colors_light) {
-        if (cli_mode == cli_mode_space) {
-            fprintf(stderr, "The space charset is incompatible with light and dark color modes.\n");
-            abort();
-        }
-        if (cli_mode != cli_mode_sextant) {
-            fprintf(stderr, "TODO dark/light color mode is only implemented for sextant charset.\n");
+static void kitty_send_direct(void) {
+    // Each chunk except the last must be a multiple of 4 base64 characters,
+    // i.e. a multiple of 3 bytes of raw data.
+    const size_t chunk = KITTY_CHUNK_SIZE / 4 * 3;
+    const uint8_t* p;
+    size_t remaining = kitty_rgb_size;
+
+    if (kitty_rgb == NULL) {
+        kitty_rgb = malloc(kitty_rgb_size);
+        if (kitty_rgb == NULL) {
+            fprintf(stderr, "Out of memory allocating kitty frame buffer!\n");
             abort();
         }
     }
+    kitty_expand_frame(kitty_rgb);
+    p = kitty_rgb;
+
+    kitty_append_keys("d");
+    for (;;) {
+        size_t step = remaining < chunk ? remaining : chunk;
+        remaining -= step;
+        if (p == kitty_rgb)
+            buffer_append_literal(",");
+        else
+            buffer_append_literal("\033_G");
+        buffer_append_cstr(remaining > 0 ? "m=1;" : "m=0;");
+        buffer_append_base64(p, step);
+        buffer_append_literal("\033\\");
+        p += step;
+        if (remaining == 0)
+            break;
+    }
+}
+
+static void draw_kitty(void) {
+    #ifdef DOOMCLI_HAVE_SHM
+    if (kitty_transfer == kitty_transfer_shm) {
+        if (kitty_send_shm())
+            return;
+        // shared memory doesn't work here; don't try again
+        kitty_transfer = kitty_transfer_direct;
+    }
+    #endif
+
+    kitty_send_direct();
+}
+
+static void init_kitty(void) {
+    kitty_rgb_size = SCREENWIDTH * SCREENHEIGHT * 3;
+
+    // Same aspect ratio correction as the character modes: a 4:3 image in
+    // 4:9 characters.
+    kitty_rows = columns * 12 / 36;
+
+    #ifdef DOOMCLI_HAVE_SHM
+    // Shared memory only works if the terminal is on this machine. If we're
+    // in an SSH session it almost certainly isn't.
+    if (kitty_transfer == 0)
+        kitty_transfer = getenv("SSH_CONNECTION") ? kitty_transfer_direct : kitty_transfer_shm;
+    atexit(kitty_shm_cleanup);
+    #else
+    kitty_transfer = kitty_transfer_direct;
+    #endif
+
+    // clear the screen once. we don't clear it every frame because that would
+    // delete the image.
+    fputs("\033[2J", stdout);
+}
+
+
+
+/*
+ * Spectators
+ *
+ * We can stream the game to any number of spectators over a UNIX domain
+ * socket and/or a TCP port on localhost. A spectator just connects and copies
+ * what it receives to its terminal, e.g.:
+ *
+ *     socat UNIX-CONNECT:/tmp/doom.sock STDOUT
+ *     nc localhost 6666
+ *
+ * The frame is resampled and fitted to cells only once no matter how many
+ * spectators there are. Each spectator has its own model of what its terminal
+ * shows so a late joiner gets a full frame first and partial updates after
+ * that. We never wait for a spectator: if one hasn't taken all of its previous
+ * update yet, it skips this frame and catches up with a larger update later.
+ */
+
+#ifdef DOOMCLI_HAVE_SOCKETS
+
+typedef struct viewer_t {
+    int fd;
+    display_t display;
+    char* pending;          // the part of its last update it hasn't taken yet
+    size_t pending_count;
+} viewer_t;
+
+static const char* spectate_path;
+static int spectate_port;
+
+static int listeners[2];
+static int listener_count;
+
+static viewer_t* viewers;
+static int viewer_count;
+static int viewer_capacity;
+
+// A spectator disconnecting shouldn't kill us with SIGPIPE. Linux has a send()
+// flag for that, the BSDs and macOS a socket option.
+#ifdef MSG_NOSIGNAL
+    #define SPECTATE_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define SPECTATE_SEND_FLAGS 0
+#endif
+
+static void spectate_cleanup(void) {
+    if (spectate_path != NULL)
+        unlink(spectate_path);
+}
+
+static void spectate_listen(int fd, struct sockaddr* address, socklen_t size,
+        const char* description)
+{
+    if (fd == -1 ||
+            bind(fd, address, size) != 0 ||
+            listen(fd, 8) != 0)
+    {
+        fprintf(stderr, "Failed to listen for spectators on %s: %s\n",
+                description, strerror(errno));
+        abort();
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    listeners[listener_count++] = fd;
+}
+
+static void init_spectate(void) {
+    if (spectate_path != NULL) {
+        struct sockaddr_un address = {0};
+        address.sun_family = AF_UNIX;
+        if (strlen(spectate_path) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "Spectate socket path is too long: \"%s\"\n", spectate_path);
+            abort();
+        }
+        strcpy(address.sun_path, spectate_path);
+
+        // replace a stale socket from an earlier run, but nothing else
+        struct stat st;
+        if (stat(spectate_path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(spectate_path);
+
+        spectate_listen(socket(AF_UNIX, SOCK_STREAM, 0),
+                (struct sockaddr*)&address, sizeof(address), spectate_path);
+        atexit(spectate_cleanup);
+    }
+
+    if (spectate_port != 0) {
+        struct sockaddr_in address = {0};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(spectate_port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int yes = 1;
+        if (fd != -1)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        spectate_listen(fd, (struct sockaddr*)&address, sizeof(address), "localhost");
+    }
+}
+
+static void spectate_accept(void) {
+    for (int i = 0; i < listener_count; ++i) {
+        for (;;) {
+            int fd = accept(listeners[i], NULL, NULL);
+            if (fd == -1)
+                break;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            #ifdef SO_NOSIGPIPE
+            int yes = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+            #endif
+
+            if (viewer_count == viewer_capacity) {
+                viewer_capacity = viewer_capacity ? viewer_capacity * 2 : 4;
+                viewers = realloc(viewers, sizeof(viewer_t) * viewer_capacity);
+                if (viewers == NULL) {
+                    fprintf(stderr, "Out of memory allocating spectators!\n");
+                    abort();
+                }
+            }
+
+            viewer_t* viewer = &viewers[viewer_count];
+            memset(viewer, 0, sizeof(*viewer));
+            viewer->fd = fd;
+            viewer->display.cells = calloc(columns * cell_rows, sizeof(cell_t));
+            if (viewer->display.cells == NULL) {
+                // we can't afford another spectator
+                close(fd);
+                continue;
+            }
+            ++viewer_count;
+        }
+    }
+}
+
+static void spectate_remove(int index) {
+    viewer_t* viewer = &viewers[index];
+    close(viewer->fd);
+    free(viewer->display.cells);
+    free(viewer->pending);
+    viewers[index] = viewers[--viewer_count];
+}
+
+// Sends as much as the spectator will take without blocking. Returns false if
+// it has disconnected.
+static bool spectate_send(viewer_t* viewer, const char* bytes, size_t count) {
+    while (count > 0) {
+        ssize_t step = send(viewer->fd, bytes, count, SPECTATE_SEND_FLAGS);
+        if (step <= 0) {
+            if (step == -1 && (errno == EWOULDBLOCK || errno == EAGAIN))
+                break;
+            return false;
+        }
+        bytes += step;
+        count -= step;
+    }
+
+    // keep the rest for next frame. (bytes may point into pending.)
+    if (count > 0) {
+        char* pending = malloc(count);
+        if (pending == NULL)
+            return false;
+        memcpy(pending, bytes, count);
+        free(viewer->pending);
+        viewer->pending = pending;
+    } else {
+        free(viewer->pending);
+        viewer->pending = NULL;
+    }
+    viewer->pending_count = count;
+    return true;
+}
+
+// Returns false if the spectator has disconnected. Spectators have nothing
+// to say so we discard anything they send.
+static bool spectate_poll(viewer_t* viewer) {
+    char discard[256];
+    for (;;) {
+        ssize_t step = read(viewer->fd, discard, sizeof(discard));
+        if (step == 0)
+            return false;
+        if (step < 0)
+            return errno == EWOULDBLOCK || errno == EAGAIN;
+    }
+}
+
+/**
+ * Sends the frame in the cells grid to all spectators.
+ *
+ * This uses the output buffer so it must be called after the frame has been
+ * written to our own terminal.
+ */
+static void spectate_frame(void) {
+    // spectators always get partial updates. without a threshold they're
+    // lossless.
+    int threshold = update_threshold < 0 ? 0 : update_threshold;
+
+    spectate_accept();
+
+    for (int i = 0; i < viewer_count;) {
+        viewer_t* viewer = &viewers[i];
+
+        if (!spectate_poll(viewer) ||
+                !spectate_send(viewer, viewer->pending, viewer->pending_count))
+        {
+            spectate_remove(i);
+            continue;
+        }
+
+        // if it's still busy with its last update, it skips this frame
+        if (viewer->pending_count > 0) {
+            ++i;
+            continue;
+        }
+
+        buffer_count = 0;
+        if (synchronized_updates)
+            buffer_append_literal("\033[?2026h");
+        if (!viewer->display.valid) {
+            buffer_append_literal("\033[2J\033[1;1H\033[?25l");
+            encode_frame();
+            display_keyframe(&viewer->display);
+        } else {
+            encode_changes(&viewer->display, threshold);
+        }
+        if (synchronized_updates)
+            buffer_append_literal("\033[?2026l");
+
+        if (!spectate_send(viewer, buffer, buffer_count)) {
+            spectate_remove(i);
+            continue;
+        }
+        ++i;
+    }
+
+    buffer_count = 0;
+}
+
+#endif
+
+
+
+/*
+ * Recording
+ *
+ * With -record-tty we write every frame we output to a file in asciicast v2
+ * format along with its time. The recording can be played back with asciinema
+ * or with cli_replay, which can also push it out as fast as possible to
+ * benchmark a terminal or transport without the game.
+ *
+ *     https://docs.asciinema.org/manual/asciicast/v2/
+ */
+
+static const char* record_path;
+static FILE* record_file;
+static uint32_t record_start;
+
+static void record_close(void) {
+    fclose(record_file);
+    record_file = NULL;
+}
+
+static void init_record(void) {
+    record_file = fopen(record_path, "wb");
+    if (record_file == NULL) {
+        fprintf(stderr, "Failed to open recording file \"%s\": %s\n", record_path, strerror(errno));
+        abort();
+    }
+
+    // The height covers the frame and the statistics below it.
+    int height = (cli_mode == cli_mode_kitty ? kitty_rows : cell_rows) + 3;
+    const char* term = getenv("TERM");
+    fprintf(record_file, "{\"version\": 2, \"width\": %i, \"height\": %i, \"timestamp\": %li",
+            columns, height, (long)time(NULL));
+    if (term != NULL && strpbrk(term, "\"\\") == NULL)
+        fprintf(record_file, ", \"env\": {\"TERM\": \"%s\"}", term);
+    fputs("}\n", record_file);
+
+    record_start = DG_GetTicksMs();
+    atexit(record_close);
+}
+
+// Writes a frame to the recording as an output event. The output is UTF-8
+// so we only need to escape quotes, backslashes and control characters.
+static void record_frame(const char* bytes, size_t count) {
+    uint32_t time = DG_GetTicksMs() - record_start;
+    fprintf(record_file, "[%u.%03u, \"o\", \"", time / 1000, time % 1000);
+
+    const char* end = bytes + count;
+    while (bytes != end) {
+        const char* start = bytes;
+        while (bytes != end && (unsigned char)*bytes >= 0x20 &&
+                *bytes != '"' && *bytes != '\\' && *bytes != 0x7f)
+            ++bytes;
+        fwrite(start, 1, bytes - start, record_file);
+        if (bytes == end)
+            break;
+
+        unsigned char c = *bytes++;
+        switch (c) {
+            case '"': fputs("\\\"", record_file); break;
+            case '\\': fputs("\\\\", record_file); break;
+            case '\n': fputs("\\n", record_file); break;
+            case '\r': fputs("\\r", record_file); break;
+            case '\t': fputs("\\t", record_file); break;
+            default: fprintf(record_file, "\\u%04x", c); break;
+        }
+    }
+
+    fputs("\"]\n", record_file);
+}
+
+
+
+/*
+ * Dynamic resolution
+ *
+ * With -target-fps we time each frame and trade detail for speed when frames
+ * take too long: first the low detail mode, then a smaller view one step at a
+ * time, as the player could do in the menu. Level 0 is whatever the player
+ * chose in the menu and each level above it gives up a bit more. The time
+ * counted is everything but sleeping (game logic, rendering, encoding and
+ * writing to the terminal) so it still tells us how much headroom we have
+ * when the game is waiting on the 35 Hz tic rate.
+ *
+ * We step down as soon as a window of frames is over budget, but only step
+ * back up when a window is well under budget, and we wait longer before
+ * trying again each time stepping up puts us straight back over budget.
+ */
+
+static int target_fps;
+
+#define QUALITY_WINDOW 16           // frames averaged for each decision
+#define QUALITY_MIN_BLOCKS 5        // smallest view size we shrink to
+#define QUALITY_MAX_PATIENCE 32     // most windows we wait before stepping up
+
+static int quality_level;
+static int quality_base_blocks;     // the player's view size and detail
+static int quality_base_detail;
+static int quality_patience = 1;    // windows of headroom needed to step up
+static int quality_good_windows;    // windows of headroom so far
+static bool quality_just_raised;
+static uint32_t quality_last_time;
+static uint32_t quality_slept;
+static uint32_t quality_busy;
+static int quality_frames;
+
+// Microseconds on a monotonic clock. Unlike DG_GetTicksMs() this is real time
+// even with DEBUG_FIXED_TICKRATE. It wraps so only differences make sense.
+static uint32_t get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static void quality_view(int level, int* blocks, int* detail) {
+    *blocks = quality_base_blocks;
+    *detail = quality_base_detail;
+    if (level > 0 && *detail == 0) {
+        *detail = 1;
+        --level;
+    }
+    *blocks -= level;
+}
+
+static int quality_max_level(void) {
+    int levels = quality_base_detail == 0 ? 1 : 0;
+    if (quality_base_blocks > QUALITY_MIN_BLOCKS)
+        levels += quality_base_blocks - QUALITY_MIN_BLOCKS;
+    return levels;
+}
+
+static void set_quality(int level) {
+    int blocks, detail;
+    quality_level = level;
+    quality_view(level, &blocks, &detail);
+    R_SetViewSize(blocks, detail);
+}
+
+// Called at the end of each frame.
+static void update_quality(void) {
+    uint32_t now = get_time_us();
+    uint32_t elapsed = now - quality_last_time;
+    uint32_t busy = elapsed > quality_slept ? elapsed - quality_slept : 0;
+    bool first = quality_last_time == 0;
+    quality_last_time = now;
+    quality_slept = 0;
+    if (first)
+        return;
+
+    // If the player changed the view in the menu we start over from it.
+    if (screenblocks != quality_base_blocks || detailLevel != quality_base_detail) {
+        quality_base_blocks = screenblocks;
+        quality_base_detail = detailLevel;
+        quality_level = 0;
+        quality_patience = 1;
+        quality_good_windows = 0;
+        quality_frames = 0;
+        quality_busy = 0;
+        return;
+    }
+
+    // Only the 3D view gets cheaper so we only judge frames that draw it.
+    if (gamestate != GS_LEVEL || automapactive) {
+        quality_frames = 0;
+        quality_busy = 0;
+        return;
+    }
+
+    quality_busy += busy;
+    if (++quality_frames < QUALITY_WINDOW)
+        return;
+    uint32_t average = quality_busy / quality_frames;
+    quality_frames = 0;
+    quality_busy = 0;
+
+    uint32_t budget = 1000000u / target_fps;
+    if (average > budget) {
+        // if we just stepped up this level is too slow; be slower to retry
+        if (quality_just_raised && quality_patience < QUALITY_MAX_PATIENCE)
+            quality_patience *= 2;
+        quality_just_raised = false;
+        quality_good_windows = 0;
+        if (quality_level < quality_max_level())
+            set_quality(quality_level + 1);
+        return;
+    }
+
+    // the level held up for a window so it can be trusted again
+    if (quality_just_raised) {
+        quality_just_raised = false;
+        if (quality_patience > 1)
+            quality_patience /= 2;
+    }
+
+    if (average < budget * 6 / 10 && quality_level > 0) {
+        if (++quality_good_windows >= quality_patience) {
+            quality_good_windows = 0;
+            quality_just_raised = true;
+            set_quality(quality_level - 1);
+        }
+    } else {
+        quality_good_windows = 0;
+    }
+}
+
+
+
+/*
+ * Zone statistics
+ *
+ * With -zone-stats we show how the zone is being used below the frame, and
+ * write all of the zone's counters to a file as one JSON object per line, once
+ * a second and once more at exit. This is meant for sizing -mb: run a session,
+ * then look at how close the zone came to full and how much it had to purge.
+ */
+
+static const char* zone_stats_path;
+static FILE* zone_stats_file;
+static uint32_t zone_stats_start;
+static uint32_t zone_stats_last;
+
+// indexed by tag (PU_STATIC is 1)
+static const char* zone_tag_names[PU_NUM_TAGS] = {
+    NULL, "static", "sound", "music", "free", "level", "levspec", "purgelevel", "cache",
+};
+
+// Percentage of free memory that isn't in the largest free block
+static int zone_fragmentation(const zonestats_t* stats) {
+    int free = stats->bytes[PU_FREE];
+    if (free <= 0)
+        return 0;
+    return 100 - (int)((int64_t)stats->largestfree * 100 / free);
+}
+
+static void write_zone_stats(void) {
+    zonestats_t stats;
+    Z_GetStats(&stats);
+
+    fprintf(zone_stats_file, "{\"time\": %u, \"zone_size\": %u, \"tags\": {",
+            DG_GetTicksMs() - zone_stats_start, Z_ZoneSize());
+    const char* separator = "";
+    for (int tag = 0; tag < PU_NUM_TAGS; ++tag) {
+        if (zone_tag_names[tag] == NULL)
+            continue;
+        fprintf(zone_stats_file, "%s\"%s\": {\"blocks\": %i, \"bytes\": %i}",
+                separator, zone_tag_names[tag], stats.blocks[tag], stats.bytes[tag]);
+        separator = ", ";
+    }
+    fprintf(zone_stats_file, "}, \"largest_free\": %i, \"fragmentation\": %i, "
+            "\"purges\": %i, \"purged_bytes\": %i, \"reread_bytes\": %u, "
+            "\"mallocs\": %u, \"malloc_ns\": [",
+            stats.largestfree, zone_fragmentation(&stats), stats.purges,
+            stats.purgedbytes, lumprereadbytes, stats.mallocs);
+    for (int i = 0; i < Z_LATENCY_BUCKETS; ++i)
+        fprintf(zone_stats_file, i == 0 ? "%u" : ", %u", stats.latency[i]);
+    fputs("]}\n", zone_stats_file);
+    fflush(zone_stats_file);
+}
+
+static void zone_stats_close(void) {
+    write_zone_stats();
+    fclose(zone_stats_file);
+    zone_stats_file = NULL;
+}
+
+static void init_zone_stats(void) {
+    zone_stats_file = fopen(zone_stats_path, "w");
+    if (zone_stats_file == NULL) {
+        fprintf(stderr, "Failed to open zone statistics file \"%s\": %s\n", zone_stats_path, strerror(errno));
+        abort();
+    }
+    zone_stats_start = zone_stats_last = DG_GetTicksMs();
+    z_timemallocs = 1;
+    atexit(zone_stats_close);
+}
+
+// Called each frame; writes the counters once a second.
+static void update_zone_stats(void) {
+    uint32_t now = DG_GetTicksMs();
+    if (now - zone_stats_last >= 1000) {
+        zone_stats_last = now;
+        write_zone_stats();
+    }
+}
+
+static void append_zone_stats(void) {
+    zonestats_t stats;
+    Z_GetStats(&stats);
+
+    int cache = stats.bytes[PU_PURGELEVEL] + stats.bytes[PU_CACHE];
+    int used = Z_ZoneSize() - stats.bytes[PU_FREE] - cache;
+    buffer_append_format("zone: %i KB used    %i KB cache    %i KB free    largest %i KB    "
+            "frag %i%%    purges %i\n",
+            used / 1024, cache / 1024, stats.bytes[PU_FREE] / 1024,
+            stats.largestfree / 1024, zone_fragmentation(&stats), stats.purges);
+}
+
+
+
+/*
+ * Fork server
+ *
+ * With -forkserver, all of the slow startup (loading the WADs, building the
+ * renderer's tables, etc.) is done once, and then we wait for sessions on a
+ * UNIX domain socket. Each connection gets a forked copy of the game, so a
+ * session starts almost immediately and everything built at startup is shared
+ * copy-on-write between the sessions.
+ *
+ * A connection hands over the session's terminal in one of two ways:
+ *
+ * - The client passes its terminal file descriptors over the socket
+ *   (SCM_RIGHTS) as soon as it connects. We do this ourselves when run with
+ *   -connect, e.g. as the forced command of an SSH session:
+ *     doomgeneric -connect /tmp/doom.sock
+ *
+ * - Anything else is taken to be inetd style: the connection itself is the
+ *   terminal. For example:
+ *     socat UNIX-CONNECT:/tmp/doom.sock STDIO,raw,echo=0
+ *
+ * The session ends when the game quits or the client hangs up.
+ */
+
+static const char* forkserver_path;
+
+#ifdef DOOMCLI_HAVE_SOCKETS
+
+// How long a new connection has to pass its terminal before we assume the
+// connection is the terminal
+#define FORKSERVER_HANDOFF_MS 200
+
+static pid_t forkserver_pid;
+static int forkserver_connection = -1;
+static int forkserver_typed = -1;   // a key that arrived with the connection
+
+static void forkserver_cleanup(void) {
+    // sessions are forked from the server; only the server owns the socket
+    if (getpid() == forkserver_pid)
+        unlink(forkserver_path);
+}
+
+// Waits briefly for the client to pass its terminal. Returns the number of
+// file descriptors received, 0 if it didn't pass any, or -1 if it hung up.
+// A byte that came without descriptors is the player typing already; it's
+// kept in forkserver_typed.
+static int forkserver_receive(int connection, int* fds) {
+    struct pollfd pollfd = {0};
+    pollfd.fd = connection;
+    pollfd.events = POLLIN;
+    if (poll(&pollfd, 1, FORKSERVER_HANDOFF_MS) != 1)
+        return 0;
+
+    unsigned char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * 3)];
+    } control;
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = &control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(connection, &message, 0) != 1)
+        return -1;
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+        forkserver_typed = byte;
+        return 0;
+    }
+    int count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(header), sizeof(int) * count);
+    return count;
+}
+
+// Makes the connection's terminal our standard input, output and error.
+// Returns false if the client hung up first.
+static bool forkserver_handoff(int connection) {
+    int fds[3];
+    int count = forkserver_receive(connection, fds);
+    if (count < 0)
+        return false;
+
+    if (count == 0) {
+        fds[0] = connection;
+        count = 1;
+    }
+
+    // A client that passes fewer than three uses its last one for the rest.
+    for (int i = 0; i < 3; ++i)
+        dup2(fds[i < count ? i : count - 1], i);
+    for (int i = 0; i < count; ++i)
+        if (fds[i] > STDERR_FILENO && fds[i] != connection)
+            close(fds[i]);
+
+    forkserver_connection = connection;
+    return true;
+}
+
+// Waits for sessions forever. Returns only in a forked session that has its
+// terminal.
+static void forkserver_run(void) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(forkserver_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Fork server socket path is too long: \"%s\"\n", forkserver_path);
+        abort();
+    }
+    strcpy(address.sun_path, forkserver_path);
+
+    // replace a stale socket from an earlier run, but nothing else
+    struct stat st;
+    if (stat(forkserver_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(forkserver_path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1 ||
+            bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+            listen(server, 16) != 0)
+    {
+        fprintf(stderr, "Failed to listen for sessions on %s: %s\n",
+                forkserver_path, strerror(errno));
+        abort();
+    }
+    forkserver_pid = getpid();
+    atexit(forkserver_cleanup);
+
+    // finished sessions are reaped automatically
+    signal(SIGCHLD, SIG_IGN);
+
+    printf("Waiting for sessions on %s\n", forkserver_path);
+
+    for (;;) {
+        // don't let the sessions inherit anything we haven't written yet
+        fflush(stdout);
+        fflush(stderr);
+
+        int connection = accept(server, NULL, NULL);
+        if (connection == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "Failed to accept a session: %s\n", strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGCHLD, SIG_DFL);
+            close(server);
+            if (!forkserver_handoff(connection))
+                exit(0);
+            #ifdef DOOMCLI_HAVE_THREADS
+            main_thread = pthread_self();
+            #endif
+            return;
+        }
+        if (pid == -1)
+            fprintf(stderr, "Failed to fork a session: %s\n", strerror(errno));
+        close(connection);
+    }
+}
+
+// Called each frame in a session; ends it once the client has hung up. We
+// only peek so that in an inetd style session the input is left alone.
+static void forkserver_check_hangup(void) {
+    char byte;
+    if (recv(forkserver_connection, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+        exit(0);
+}
+
+// The client side: passes our terminal to the fork server at path and waits
+// for the session to end.
+static int forkserver_connect(const char* path) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Fork server socket path is too long: \"%s\"\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, path);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection == -1 ||
+            connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    unsigned char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = &control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    if (sendmsg(connection, &message, 0) != 1) {
+        fprintf(stderr, "Failed to pass the terminal to %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // The session has our terminal now. It closes the connection when it's
+    // over, and if we're killed (e.g. Ctrl+C) it sees us hang up and quits.
+    for (;;) {
+        ssize_t step = read(connection, &byte, 1);
+        if (step == 0 || (step == -1 && errno != EINTR))
+            break;
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
+
+
+
+/*
+ * Callbacks
+ */
+
+static void setup_io(void) {
+
+    // TODO need to set up signals to reset termios
+
+    // unbuffered
+    setvbuf(stdin, NULL, _IONBF, BUFSIZ);
+
+    // non-blocking
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+#ifndef DEBUG_FIXED_TICKRATE
+    // non-canonical, no echo
+    struct termios termios;
+    tcgetattr(STDIN_FILENO, &termios);
+    termios.c_lflag &= ~(ECHO | ICANON);
+    //cfmakeraw(&termios);
+    tcsetattr(STDIN_FILENO, TCSANOW, &termios);
+#endif
+
+}
+
+static void parse_cli_options() {
+    int arg = M_CheckParmWithArgs("-charset", 1);
+    if (arg)
+    {
+        const char* charset = myargv[arg + 1];
+        if (0 == strcmp(charset, "sextant")) {
+            cli_mode = cli_mode_sextant;
+        } else if (0 == strcmp(charset, "quadrant")) {
+            cli_mode = cli_mode_quadrant;
+        } else if (0 == strcmp(charset, "half")) {
+            cli_mode = cli_mode_half;
+        } else if (0 == strcmp(charset, "space")) {
+            cli_mode = cli_mode_space;
+        } else if (0 == strcmp(charset, "kitty")) {
+            cli_mode = cli_mode_kitty;
+        } else {
+            fprintf(stderr, "Unrecognized charset option: \"%s\"\n", charset);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-color", 1);
+    if (arg)
+    {
+        const char* color = myargv[arg + 1];
+        if (0 == strcmp(color, "24bit")) {
+            cli_colors = cli_colors_24bit;
+        } else if (0 == strcmp(color, "8bit")) {
+            cli_colors = cli_colors_8bit;
+        } else if (0 == strcmp(color, "4bit")) {
+            cli_colors = cli_colors_4bit;
+        } else if (0 == strcmp(color, "3bit")) {
+            cli_colors = cli_colors_3bit;
+        } else if (0 == strcmp(color, "light")) {
+            cli_colors = cli_colors_light;
+        } else if (0 == strcmp(color, "dark")) {
+            cli_colors = cli_colors_dark;
+        } else {
+            fprintf(stderr, "Unrecognized color option: \"%s\"\n", color);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-filter", 1);
+    if (arg)
+    {
+        const char* filter = myargv[arg + 1];
+        if (0 == strcmp(filter, "box")) {
+            // TODO
+        } else if (0 == strcmp(filter, "nearest")) {
+            // TODO
+        } else {
+            // TODO
+        }
+        fprintf(stderr, "Filter option is not yet implemented.\n");
+        abort();
+    }
+
+    arg = M_CheckParmWithArgs("-noise", 1);
+    if (arg)
+    {
+        const char* noise = myargv[arg + 1];
+        if (0 == strcmp(noise, "on")) {
+            noise_enabled = true;
+        } else if (0 == strcmp(noise, "off")) {
+            noise_enabled = false;
+        } else {
+            fprintf(stderr, "Unrecognized noise option: \"%s\"\n", noise);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-noise-speed", 1);
+    if (arg)
+    {
+        noise_speed = atoi(myargv[arg + 1]);
+    }
+
+    arg = M_CheckParmWithArgs("-noise-strength", 1);
+    if (arg)
+    {
+        // TODO
+        fprintf(stderr, "Noise strength option is not yet implemented.\n");
+        abort();
+    }
+
+    arg = M_CheckParmWithArgs("-stable", 1);
+    if (arg)
+    {
+        const char* stable = myargv[arg + 1];
+        if (0 == strcmp(stable, "on")) {
+            stable_enabled = true;
+        } else if (0 == strcmp(stable, "off")) {
+            stable_enabled = false;
+        } else {
+            fprintf(stderr, "Unrecognized stable option: \"%s\"\n", stable);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-stable-margin", 1);
+    if (arg)
+    {
+        stable_margin = atoi(myargv[arg + 1]);
+    }
+
+    arg = M_CheckParmWithArgs("-update-threshold", 1);
+    if (arg)
+    {
+        update_threshold = atoi(myargv[arg + 1]);
+        if (update_threshold < 0) {
+            fprintf(stderr, "Invalid update threshold: \"%s\"\n", myargv[arg + 1]);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-spectate-socket", 1);
+    if (arg)
+    {
+        #ifdef DOOMCLI_HAVE_SOCKETS
+        spectate_path = myargv[arg + 1];
+        #else
+        fprintf(stderr, "Spectating is not supported on this platform.\n");
+        abort();
+        #endif
+    }
+
+    arg = M_CheckParmWithArgs("-spectate-port", 1);
+    if (arg)
+    {
+        #ifdef DOOMCLI_HAVE_SOCKETS
+        spectate_port = atoi(myargv[arg + 1]);
+        if (spectate_port <= 0 || spectate_port > 65535) {
+            fprintf(stderr, "Invalid spectate port: \"%s\"\n", myargv[arg + 1]);
+            abort();
+        }
+        #else
+        fprintf(stderr, "Spectating is not supported on this platform.\n");
+        abort();
+        #endif
+    }
+
+    arg = M_CheckParmWithArgs("-forkserver", 1);
+    if (arg)
+    {
+        #ifdef DOOMCLI_HAVE_SOCKETS
+        forkserver_path = myargv[arg + 1];
+        #else
+        fprintf(stderr, "The fork server is not supported on this platform.\n");
+        abort();
+        #endif
+    }
+
+    arg = M_CheckParmWithArgs("-record-tty", 1);
+    if (arg)
+    {
+        record_path = myargv[arg + 1];
+    }
+
+    arg = M_CheckParmWithArgs("-columns", 1);
+    if (arg)
+    {
+        columns = atoi(myargv[arg + 1]);
+    }
+
+    arg = M_CheckParmWithArgs("-render-size", 1);
+    if (arg)
+    {
+        const char* size = myargv[arg + 1];
+        if (0 == strcmp(size, "auto")) {
+            render_width = 0;
+            render_height = 0;
+        } else {
+            char* end;
+            render_width = strtol(size, &end, 10);
+            if (*end == 'x')
+                render_height = strtol(end + 1, &end, 10);
+            if (*end != 0 || render_width < 2 || render_height < 2 ||
+                    render_width > MAXWIDTH || render_height > MAXHEIGHT ||
+                    (render_width & 1))
+            {
+                fprintf(stderr, "Invalid render size: \"%s\" (must be auto or WxH with an even W up to %ix%i)\n",
+                        size, MAXWIDTH, MAXHEIGHT);
+                abort();
+            }
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-render-threads", 1);
+    if (arg)
+    {
+        #ifdef DOOMCLI_HAVE_THREADS
+        r_numthreads = atoi(myargv[arg + 1]);
+        if (r_numthreads < 1 || r_numthreads > MAXRENDERTHREADS) {
+            fprintf(stderr, "Invalid render threads: \"%s\" (must be 1 to %i)\n",
+                    myargv[arg + 1], MAXRENDERTHREADS);
+            abort();
+        }
+        #else
+        fprintf(stderr, "Render threads are not supported on this platform.\n");
+        abort();
+        #endif
+    }
+
+    arg = M_CheckParmWithArgs("-render-layout", 1);
+    if (arg)
+    {
+        const char* layout = myargv[arg + 1];
+        if (0 == strcmp(layout, "columns")) {
+            r_columnmajor = true;
+        } else if (0 == strcmp(layout, "rows")) {
+            r_columnmajor = false;
+        } else {
+            fprintf(stderr, "Invalid render layout: \"%s\" (must be columns or rows)\n", layout);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-render-deferred", 1);
+    if (arg)
+    {
+        const char* deferred = myargv[arg + 1];
+        if (0 == strcmp(deferred, "on")) {
+            r_deferred = true;
+        } else if (0 == strcmp(deferred, "off")) {
+            r_deferred = false;
+        } else {
+            fprintf(stderr, "Invalid render deferred: \"%s\" (must be on or off)\n", deferred);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-render-walk", 1);
+    if (arg)
+    {
+        const char* walk = myargv[arg + 1];
+        if (0 == strcmp(walk, "single")) {
+            r_singlewalk = true;
+        } else if (0 == strcmp(walk, "classic")) {
+            r_singlewalk = false;
+        } else {
+            fprintf(stderr, "Invalid render walk: \"%s\" (must be single or classic)\n", walk);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-texture-cache", 1);
+    if (arg)
+    {
+        const char* cache = myargv[arg + 1];
+        if (0 == strcmp(cache, "on")) {
+            r_bakedata = true;
+        } else if (0 == strcmp(cache, "off")) {
+            r_bakedata = false;
+        } else {
+            fprintf(stderr, "Invalid texture cache: \"%s\" (must be on or off)\n", cache);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-zone-stats", 1);
+    if (arg)
+    {
+        zone_stats_path = myargv[arg + 1];
+    }
+
+    arg = M_CheckParmWithArgs("-target-fps", 1);
+    if (arg)
+    {
+        target_fps = atoi(myargv[arg + 1]);
+        if (target_fps < 1) {
+            fprintf(stderr, "Invalid target FPS: \"%s\"\n", myargv[arg + 1]);
+            abort();
+        }
+    }
+
+    arg = M_CheckParmWithArgs("-kitty-transfer", 1);
+    if (arg)
+    {
+        const char* transfer = myargv[arg + 1];
+        if (0 == strcmp(transfer, "shm")) {
+            #ifdef DOOMCLI_HAVE_SHM
+            kitty_transfer = kitty_transfer_shm;
+            #else
+            fprintf(stderr, "Shared memory transfer is not supported on this platform.\n");
+            abort();
+            #endif
+        } else if (0 == strcmp(transfer, "direct")) {
+            kitty_transfer = kitty_transfer_direct;
+        } else {
+            fprintf(stderr, "Unrecognized kitty transfer option: \"%s\"\n", transfer);
+            abort();
+        }
+    }
+
+    if (cli_mode == cli_mode_kitty && update_threshold >= 0) {
+        fprintf(stderr, "The kitty charset is incompatible with the update threshold.\n");
+        abort();
+    }
+
+    #ifdef DOOMCLI_HAVE_SOCKETS
+    if (cli_mode == cli_mode_kitty && (spectate_path != NULL || spectate_port != 0)) {
+        fprintf(stderr, "The kitty charset is incompatible with spectating.\n");
+        abort();
+    }
+    #endif
+
+    // Every session would share these.
+    #ifdef DOOMCLI_HAVE_SOCKETS
+    if (forkserver_path != NULL && (spectate_path != NULL || spectate_port != 0 ||
+                record_path != NULL || zone_stats_path != NULL))
+    {
+        fprintf(stderr, "The fork server is incompatible with spectating, -record-tty and -zone-stats.\n");
+        abort();
+    }
+    #endif
+
+    if (cli_colors == cli_colors_dark || cli_colors == cli_colors_light) {
+        if (cli_mode == cli_mode_kitty) {
+            fprintf(stderr, "The kitty charset is incompatible with light and dark color modes.\n");
+            abort();
+        }
+        if (cli_mode == cli_mode_space) {
+            fprintf(stderr, "The space charset is incompatible with light and dark color modes.\n");
+            abort();
+        }
+        if (cli_mode != cli_mode_sextant) {
+            fprintf(stderr, "TODO dark/light color mode is only implemented for sextant charset.\n");
+            abort();
+        }
+    }
+}
+
+// Everything that belongs to the player's terminal rather than to the game.
+// With -forkserver this is done in each session instead of at startup.
+static void start_session(void) {
+    setup_io();
+
+    if (cli_mode == cli_mode_kitty)
+        init_kitty();
+
+    #ifdef DOOMCLI_HAVE_SOCKETS
+    init_spectate();
+    #endif
+
+    if (record_path != NULL)
+        init_record();
+
+    if (zone_stats_path != NULL)
+        init_zone_stats();
+}
+
+// Called by D_DoomLoop once startup is done, just before the game starts.
+void doomcli_start_session(void) {
+    #ifdef DOOMCLI_HAVE_SOCKETS
+    if (forkserver_path != NULL) {
+        forkserver_run();
+        start_session();
+        if (forkserver_typed != -1)
+            ungetc(forkserver_typed, stdin);
+    }
+    #endif
 }
 
 void DG_Init()
 {
-    setup_io();
+    #ifdef DOOMCLI_HAVE_THREADS
+    main_thread = pthread_self();
+    #endif
 
     parse_cli_options();
 
@@ -1356,6 +2954,7 @@ void DG_Init()
     switch (cli_mode) {
         case cli_mode_space:
         case cli_mode_half:
+        case cli_mode_kitty:
             // nothing
             break;
         case cli_mode_quadrant:
@@ -1382,10 +2981,60 @@ void DG_Init()
             dest_height = dest_width * 18 / 36;
             dest_height = dest_height / 3 * 3;
             break;
+        case cli_mode_kitty:
+            // the frame is sent at full resolution; we don't resample it
+            dest_height = 0;
+            break;
+    }
+
+    // Render at the destination size unless told otherwise. There's no point
+    // rendering pixels we'd throw away when resampling. (The width must be
+    // even.) Kitty mode sends the frame as-is so it keeps the original size.
+    if (render_width == 0) {
+        if (cli_mode == cli_mode_kitty) {
+            render_width = ORIGWIDTH;
+            render_height = ORIGHEIGHT;
+        } else {
+            render_width = (dest_width + 1) & ~1;
+            render_height = dest_height;
+            if (render_width > MAXWIDTH)
+                render_width = MAXWIDTH;
+            if (render_height > MAXHEIGHT)
+                render_height = MAXHEIGHT;
+        }
     }
+    screenwidth = render_width;
+    screenheight = render_height;
 
     dest_buffer = malloc(sizeof(uint32_t) * dest_width * dest_height);
 
+    switch (cli_mode) {
+        case cli_mode_space: cell_rows = dest_height; break;
+        case cli_mode_half: cell_rows = dest_height / 2; break;
+        case cli_mode_quadrant: cell_rows = dest_height / 2; break;
+        case cli_mode_sextant: cell_rows = dest_height / 3; break;
+        case cli_mode_kitty: cell_rows = 0; break;
+    }
+    cells = malloc(sizeof(cell_t) * columns * cell_rows);
+    if (update_threshold >= 0)
+        display.cells = calloc(columns * cell_rows, sizeof(cell_t));
+    if ((cells == NULL || (update_threshold >= 0 && display.cells == NULL)) && cell_rows > 0) {
+        fprintf(stderr, "Out of memory allocating cells!\n");
+        abort();
+    }
+
+    if (forkserver_path == NULL)
+        start_session();
+
+    // one entry per pixel is more than enough cells for any charset
+    if (stable_enabled) {
+        stable_cells = calloc(dest_width * dest_height, sizeof(cell_fit_t));
+        if (stable_cells == NULL) {
+            fprintf(stderr, "Out of memory allocating cell fits!\n");
+            abort();
+        }
+    }
+
 
     // Send a synchronized output query. This will tell us whether the terminal
     // supports synchronized updates.
@@ -1418,7 +3067,8 @@ void DG_DrawFrame()
 //return;
 //printf("DG_DrawFrame() exiting\n");
 //exit(0);
-    if (noise_enabled) {
+    // in stable mode the dither pattern stays fixed
+    if (noise_enabled && !stable_enabled) {
         uint32_t time = DG_GetTicksMs();
         if (time - noise_last_time > noise_speed) {
             noise_last_time = time;
@@ -1429,27 +3079,39 @@ void DG_DrawFrame()
 //printf("%s %i  resampling down\n",__func__, DG_GetTicksMs());
     // resample the frame down
     // TODO for now we just choose the nearest pixel, need to implement at least a box filter
-    uint32_t* dest_pixel = dest_buffer;
-    for (int y = 0; y < dest_height; ++y) {
-        for (int x = 0; x < dest_width; ++x) {
-            int sy = y * DOOMGENERIC_RESY / dest_height;
-            int sx = x * DOOMGENERIC_RESX / dest_width;
-
-            // old code letting doomgeneric build a 32-bit screenbuffer
-            //*dest_pixel++ = DG_ScreenBuffer[sy * DOOMGENERIC_RESX + sx];
-
-            // new code using palette directly
-            *dest_pixel++ = *(uint32_t*)(colors + I_VideoBuffer[sy * SCREENWIDTH + sx]);
+    if (cli_mode != cli_mode_kitty) {
+        uint32_t* dest_pixel = dest_buffer;
+        for (int y = 0; y < dest_height; ++y) {
+            for (int x = 0; x < dest_width; ++x) {
+                int sy = y * SCREENHEIGHT / dest_height;
+                int sx = x * SCREENWIDTH / dest_width;
+
+                // new code using palette directly
+                *dest_pixel++ = *(uint32_t*)(colors + I_VideoBuffer[sy * SCREENWIDTH + sx]);
+            }
         }
     }
 
+    // with an update threshold we only redraw everything on the first frame
+    bool keyframe = update_threshold < 0 || !display.valid;
+
     // use synchronized updates if supported. append a newline in case it's not.
+    // (Terminals with kitty graphics support synchronized updates, and the
+    // newline could scroll the image. We don't send it for partial updates
+    // either since they don't clear the screen.)
     if (synchronized_updates) {
-        buffer_append_literal("\033[?2026h\n");
+        if (cli_mode == cli_mode_kitty || !keyframe)
+            buffer_append_literal("\033[?2026h");
+        else
+            buffer_append_literal("\033[?2026h\n");
     }
 
-    // clear the screen
-    buffer_append_literal("\033[2J\033[1;1H");
+    // clear the screen (except in kitty mode where the image is replaced in
+    // place; clearing would delete it and cause flicker)
+    if (cli_mode == cli_mode_kitty)
+        buffer_append_literal("\033[1;1H");
+    else if (keyframe)
+        buffer_append_literal("\033[2J\033[1;1H");
 
     // hide the cursor
     buffer_append_literal("\033[?25l");
@@ -1471,6 +3133,23 @@ void DG_DrawFrame()
             else
                 draw_sextant();
             break;
+        case cli_mode_kitty:
+            draw_kitty();
+            // put the statistics below the image
+            buffer_append_format("\033[%i;1H\033[0J", kitty_rows + 1);
+            break;
+    }
+
+    if (cli_mode != cli_mode_kitty) {
+        if (keyframe) {
+            encode_frame();
+            if (update_threshold >= 0)
+                display_keyframe(&display);
+        } else {
+            encode_changes(&display, update_threshold);
+            // put the statistics below the frame
+            buffer_append_format("\033[%i;1H\033[0J", cell_rows + 1);
+        }
     }
 
     // append statistics
@@ -1505,7 +3184,20 @@ void DG_DrawFrame()
         }
         buffer_append("\n", 1);
 
-        buffer_append_format("key repeat delay: %i ms    key repeat rate: %i ms\n", key_repeat_delay, key_repeat_rate);
+        buffer_append_format("key repeat delay: %i ms    key repeat rate: %i ms", key_repeat_delay, key_repeat_rate);
+        #ifdef DOOMCLI_HAVE_SOCKETS
+        if (listener_count > 0)
+            buffer_append_format("    spectators: %i", viewer_count);
+        #endif
+        if (target_fps > 0) {
+            int blocks, detail;
+            quality_view(quality_level, &blocks, &detail);
+            buffer_append_format("    view size: %i%s", blocks, detail ? " (low detail)" : "");
+        }
+        buffer_append("\n", 1);
+
+        if (zone_stats_file != NULL)
+            append_zone_stats();
     }
 
     // show the cursor
@@ -1538,7 +3230,23 @@ void DG_DrawFrame()
     }
 #endif
 
+    if (record_file != NULL)
+        record_frame(buffer, buffer_count);
+
     buffer_count = 0;
+
+    if (target_fps > 0)
+        update_quality();
+
+    if (zone_stats_file != NULL)
+        update_zone_stats();
+
+    #ifdef DOOMCLI_HAVE_SOCKETS
+    if (listener_count > 0)
+        spectate_frame();
+    if (forkserver_connection != -1)
+        forkserver_check_hangup();
+    #endif
 //printf("%s %i  done\n",__func__, DG_GetTicksMs());
 }
 
@@ -1548,6 +3256,12 @@ void DG_SleepMs(uint32_t ms)
     #ifdef DEBUG_FIXED_TICKRATE
     return;
     #endif
+    if (target_fps > 0) {
+        uint32_t start = get_time_us();
+        usleep (ms * 1000);
+        quality_slept += get_time_us() - start;
+        return;
+    }
     usleep (ms * 1000);
 }
 
@@ -1806,6 +3520,12 @@ static void handle_csi(int* c) {
 // This function is called all over the place during rendering. We want to
 // check for input often in order to get precise timing on key repeats.
 void doomcli_read_input(void) {
+    #ifdef DOOMCLI_HAVE_THREADS
+    // Render worker threads get here too. Only the main thread reads input.
+    if (!pthread_equal(pthread_self(), main_thread))
+        return;
+    #endif
+
     int c = getchar();
     for (;;) {
         if (c == -1)
@@ -1968,6 +3688,12 @@ static void show_cursor(void) {
 
 int main(int argc, char **argv)
 {
+    #ifdef DOOMCLI_HAVE_SOCKETS
+    for (int i = 1; i + 1 < argc; ++i)
+        if (0 == strcmp(argv[i], "-connect"))
+            return forkserver_connect(argv[i + 1]);
+    #endif
+
     atexit(show_cursor);
 
 //for (int i = 0; i < 64; ++i){printf("%u ",i);puts(sextants[i]);}abort();
@@ -189,6 +189,9 @@ extern  boolean	usergame;
 extern  boolean	demoplayback;
 extern  boolean	demorecording;
 
+// Playing back a demo with -timedemo.
+extern  boolean	timingdemo;
+
 // Round angleturn in ticcmds to the nearest 256.  This is used when
 // recording Vanilla demos in netgames.
 
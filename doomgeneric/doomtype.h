@@ -108,8 +108,22 @@ typedef uint8_t byte;
     #else
         #define DOOMCLI_READ_INPUT() doomcli_read_input()
     #endif
+    void doomcli_start_session(void);
+    #define DOOMCLI_START_SESSION() doomcli_start_session()
 #else
     #define DOOMCLI_READ_INPUT() /*nothing*/
+    #define DOOMCLI_START_SESSION() /*nothing*/
+#endif
+
+// The renderer can split the view into strips drawn on separate threads (see
+// r_numthreads.) Its per-frame working state is thread-local so that each
+// thread has its own. This needs POSIX threads, so it's only built for
+// doom-cli and not on Onramp.
+#if defined(DOOM_CLI) && !defined(__onramp__)
+    #define R_THREADS
+    #define R_THREADLOCAL __thread
+#else
+    #define R_THREADLOCAL /*nothing*/
 #endif
 
 #endif
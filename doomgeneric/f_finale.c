@@ -242,16 +242,10 @@ void F_TextWrite (void)
 	
     for (y=0 ; y<SCREENHEIGHT ; y++)
     {
-	for (x=0 ; x<SCREENWIDTH/64 ; x++)
-	{
-	    memcpy (dest, src+((y&63)<<6), 64);
-	    dest += 64;
-	}
-	if (SCREENWIDTH&63)
-	{
-	    memcpy (dest, src+((y&63)<<6), SCREENWIDTH&63);
-	    dest += (SCREENWIDTH&63);
-	}
+	byte *row = src + (((y * ORIGHEIGHT / SCREENHEIGHT) & 63) << 6);
+
+	for (x=0 ; x<SCREENWIDTH ; x++)
+	    *dest++ = row[(x * ORIGWIDTH / SCREENWIDTH) & 63];
     }
 
     V_MarkRect (0, 0, SCREENWIDTH, SCREENHEIGHT);
@@ -284,7 +278,7 @@ void F_TextWrite (void)
 	}
 		
 	w = SHORT (hu_font[c]->width);
-	if (cx+w > SCREENWIDTH)
+	if (cx+w > ORIGWIDTH)
 	    break;
 	V_DrawPatch(cx, cy, hu_font[c]);
 	cx+=w;
@@ -578,21 +572,23 @@ F_DrawPatchCol
     byte*	source;
     byte*	dest;
     byte*	desttop;
-    int		count;
+    int		y;
+    int		y1;
 	
     column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
     desttop = I_VideoBuffer + x;
 
-    // step through the posts in a column
+    // step through the posts in a column, scaling them to the screen
     while (column->topdelta != 0xff )
     {
 	source = (byte *)column + 3;
-	dest = desttop + column->topdelta*SCREENWIDTH;
-	count = column->length;
+	y = SCREENY(column->topdelta);
+	y1 = SCREENY(column->topdelta + column->length);
+	dest = desttop + y*SCREENWIDTH;
 		
-	while (count--)
+	for ( ; y<y1 ; y++)
 	{
-	    *dest = *source++;
+	    *dest = source[y * ORIGHEIGHT / SCREENHEIGHT - column->topdelta];
 	    dest += SCREENWIDTH;
 	}
 	column = (column_t *)(  (byte *)column + column->length + 4 );
@@ -626,18 +622,20 @@ void F_BunnyScroll (void)
 		
     for ( x=0 ; x<SCREENWIDTH ; x++)
     {
-	if (x+scrolled < 320)
-	    F_DrawPatchCol (x, p1, x+scrolled);
+	int ox = x * ORIGWIDTH / SCREENWIDTH;
+
+	if (ox+scrolled < 320)
+	    F_DrawPatchCol (x, p1, ox+scrolled);
 	else
-	    F_DrawPatchCol (x, p2, x+scrolled - 320);		
+	    F_DrawPatchCol (x, p2, ox+scrolled - 320);		
     }
 	
     if (finalecount < 1130)
 	return;
     if (finalecount < 1180)
     {
-        V_DrawPatch((SCREENWIDTH - 13 * 8) / 2,
-                    (SCREENHEIGHT - 8 * 8) / 2, 
+        V_DrawPatch((ORIGWIDTH - 13 * 8) / 2,
+                    (ORIGHEIGHT - 8 * 8) / 2, 
                     W_CacheLumpName(DEH_String("END0"), PU_CACHE));
 	laststage = 0;
 	return;
@@ -653,8 +651,8 @@ void F_BunnyScroll (void)
     }
 	
     DEH_snprintf(name, 10, "END%i", stage);
-    V_DrawPatch((SCREENWIDTH - 13 * 8) / 2, 
-                (SCREENHEIGHT - 8 * 8) / 2, 
+    V_DrawPatch((ORIGWIDTH - 13 * 8) / 2, 
+                (ORIGHEIGHT - 8 * 8) / 2, 
                 W_CacheLumpName (name,PU_CACHE));
 }
 
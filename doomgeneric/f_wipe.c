@@ -127,6 +127,8 @@ wipe_exitColorXForm
 }
 
 
+// column positions, in the original 320x200 coordinates so the melt
+// takes as long regardless of the screen size
 static int*	y;
 
 int
@@ -147,9 +149,9 @@ wipe_initMelt
     
     // setup initial column positions
     // (y<0 => not ready to scroll yet)
-    y = (int *) Z_Malloc(width*sizeof(int), PU_STATIC, 0);
+    y = (int *) Z_Malloc(ORIGWIDTH*sizeof(int), PU_STATIC, 0);
     y[0] = -(M_Random()%16);
-    for (i=1;i<width;i++)
+    for (i=1;i<ORIGWIDTH;i++)
     {
 	r = (M_Random()%3) - 1;
 	y[i] = y[i-1] + r;
@@ -169,6 +171,8 @@ wipe_doMelt
     int		i;
     int		j;
     int		dy;
+    int		sx, sx1;
+    int		sy, sy1;
     int		idx;
     
     short*	s;
@@ -179,7 +183,7 @@ wipe_doMelt
 
     while (ticks--)
     {
-	for (i=0;i<width;i++)
+	for (i=0;i<ORIGWIDTH/2;i++)
 	{
 		if (!(i & 0x1f)) {
 			DOOMCLI_READ_INPUT();
@@ -188,26 +192,34 @@ wipe_doMelt
 	    {
 		y[i]++; done = false;
 	    }
-	    else if (y[i] < height)
+	    else if (y[i] < ORIGHEIGHT)
 	    {
 		dy = (y[i] < 16) ? y[i]+1 : 8;
-		if (y[i]+dy >= height) dy = height - y[i];
-		s = &((short *)wipe_scr_end)[i*height+y[i]];
-		d = &((short *)wipe_scr)[y[i]*width+i];
-		idx = 0;
-		for (j=dy;j;j--)
-		{
-		    d[idx] = *(s++);
-		    idx += width;
-		}
+		if (y[i]+dy >= ORIGHEIGHT) dy = ORIGHEIGHT - y[i];
+
+		// update the screen columns that map to this column: reveal
+		// dy more rows of the end screen and push the start screen down
+		sy = (y[i]*height + ORIGHEIGHT-1) / ORIGHEIGHT;
+		sy1 = ((y[i]+dy)*height + ORIGHEIGHT-1) / ORIGHEIGHT;
 		y[i] += dy;
-		s = &((short *)wipe_scr_start)[i*height];
-		d = &((short *)wipe_scr)[y[i]*width+i];
-		idx = 0;
-		for (j=height-y[i];j;j--)
+		sx = (i*width + ORIGWIDTH/2-1) / (ORIGWIDTH/2);
+		sx1 = ((i+1)*width + ORIGWIDTH/2-1) / (ORIGWIDTH/2);
+		for ( ; sx<sx1 ; sx++)
 		{
-		    d[idx] = *(s++);
-		    idx += width;
+		    s = &((short *)wipe_scr_end)[sx*height+sy];
+		    d = &((short *)wipe_scr)[sy*width+sx];
+		    idx = 0;
+		    for (j=sy1-sy;j;j--)
+		    {
+			d[idx] = *(s++);
+			idx += width;
+		    }
+		    s = &((short *)wipe_scr_start)[sx*height];
+		    for (j=height-sy1;j;j--)
+		    {
+			d[idx] = *(s++);
+			idx += width;
+		    }
 		}
 		done = false;
 	    }
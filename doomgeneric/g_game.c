@@ -1013,6 +1013,7 @@ void G_Ticker (void)
 	 
       case GS_INTERMISSION: 
 	WI_Ticker (); 
+	R_PrecacheStep ();
 	break; 
 			 
       case GS_FINALE: 
@@ -1485,6 +1486,10 @@ void G_DoCompleted (void)
     StatCopy(&wminfo);
  
     WI_Start (&wminfo); 
+
+    // Load the next level's graphics while the tally is up.
+    if (precache)
+	R_StartPrecache (gameepisode, wminfo.next+1);
 } 
 
 
@@ -88,6 +88,11 @@ void I_GetEvent(void);
 
 byte *I_VideoBuffer = NULL;
 
+// The screen size; see i_video.h
+
+int screenwidth = ORIGWIDTH;
+int screenheight = ORIGHEIGHT;
+
 // If true, game is running as a screensaver
 
 boolean screensaver_mode = false;
@@ -234,6 +239,7 @@ void I_InitGraphics (void)
 
     /* Allocate screen to draw to */
 	I_VideoBuffer = (byte*)Z_Malloc (SCREENWIDTH * SCREENHEIGHT, PU_STATIC, NULL);  // For DOOM to draw on
+	memset (I_VideoBuffer, 0, SCREENWIDTH * SCREENHEIGHT);  // the first wipe starts from it
 
 	screenvisible = true;
 
@@ -22,10 +22,34 @@
 
 #include "doomtype.h"
 
-// Screen width and height.
+// Original screen width and height. The 2D graphics (menus, status bar,
+// intermission, etc.) are positioned in these coordinates and scaled to the
+// screen.
 
-#define SCREENWIDTH  320
-#define SCREENHEIGHT 200
+#define ORIGWIDTH  320
+#define ORIGHEIGHT 200
+
+// Largest supported screen width and height. These size the renderer's
+// static arrays.
+
+#define MAXWIDTH  (ORIGWIDTH * 4)
+#define MAXHEIGHT (ORIGHEIGHT * 4)
+
+// Screen width and height. These default to the original size. A platform
+// can change them before graphics are initialized (e.g. in DG_Init()) to
+// render at a different resolution. The width must be even.
+
+extern int screenwidth;
+extern int screenheight;
+
+#define SCREENWIDTH  screenwidth
+#define SCREENHEIGHT screenheight
+
+// Convert original x and y coordinates to screen coordinates, rounding up.
+// The coordinates must not be negative.
+
+#define SCREENX(x) (((x) * SCREENWIDTH + ORIGWIDTH - 1) / ORIGWIDTH)
+#define SCREENY(y) (((y) * SCREENHEIGHT + ORIGHEIGHT - 1) / ORIGHEIGHT)
 
 // Screen width used for "squash" scale functions
 
@@ -0,0 +1,260 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//      Timing of startup and level loading (-profile-startup).
+//
+//      Each phase records its wall clock time, the CPU time used
+//      and the bytes allocated from the zone. They are printed as
+//      a table, and can also be written out as a Chrome trace
+//      (JSON Trace Event Format) to look at with chrome://tracing
+//      or Perfetto.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "doomtype.h"
+#include "i_system.h"
+#include "i_timer.h"
+#include "m_argv.h"
+#include "m_misc.h"
+#include "z_zone.h"
+
+#include "m_profile.h"
+
+#define MAXPHASES 512
+#define MAXDEPTH 16
+
+typedef struct
+{
+    char name[32];
+    int depth;
+    boolean done;
+
+    // While the phase is open these hold the values at its
+    // start; when it ends, what it used. Times are in
+    // microseconds and all of these wrap.
+
+    unsigned int start;
+    unsigned int wall;
+    unsigned int cpu;
+    unsigned int zonebytes;
+} phase_t;
+
+static boolean profiling = false;
+static char *tracefile = NULL;
+static unsigned int basetime;
+
+static phase_t phases[MAXPHASES];
+static int numphases = 0;
+static int printedphases = 0;
+
+// Phases begun and not yet ended, innermost last. -1 for one
+// that didn't fit in phases[].
+
+static int openphases[MAXDEPTH];
+static int depth = 0;
+
+static unsigned int WallTime(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return I_GetTimeMS() * 1000;
+#endif
+}
+
+static unsigned int CPUTime(void)
+{
+    return (unsigned int) ((long long) clock() * 1000000 / CLOCKS_PER_SEC);
+}
+
+static unsigned int ZoneBytes(void)
+{
+    zonestats_t stats;
+
+    Z_GetStats(&stats);
+    return stats.mallocbytes;
+}
+
+void M_ProfileInit(void)
+{
+    int p;
+
+    //!
+    // @arg [<file>]
+    //
+    // Time each step of startup and of loading each level, and
+    // print a table of them. With a file, also write them to it
+    // as a Chrome trace.
+    //
+
+    p = M_CheckParm("-profile-startup");
+
+    if (p == 0)
+    {
+        return;
+    }
+
+    if (p + 1 < myargc && myargv[p + 1][0] != '-')
+    {
+        tracefile = myargv[p + 1];
+    }
+
+    profiling = true;
+    basetime = WallTime();
+
+    // Whatever was still going on when we quit.
+
+    I_AtExit(M_ProfilePrint, true);
+}
+
+void M_ProfileBegin(const char *name)
+{
+    phase_t *phase;
+
+    if (!profiling)
+    {
+        return;
+    }
+
+    if (depth < MAXDEPTH)
+    {
+        if (numphases < MAXPHASES)
+        {
+            phase = &phases[numphases];
+            M_StringCopy(phase->name, name, sizeof(phase->name));
+            phase->depth = depth;
+            phase->done = false;
+            phase->start = WallTime() - basetime;
+            phase->cpu = CPUTime();
+            phase->zonebytes = ZoneBytes();
+            openphases[depth] = numphases++;
+        }
+        else
+        {
+            openphases[depth] = -1;
+        }
+    }
+
+    ++depth;
+}
+
+void M_ProfileEnd(void)
+{
+    phase_t *phase;
+
+    if (!profiling || depth == 0)
+    {
+        return;
+    }
+
+    --depth;
+
+    if (depth >= MAXDEPTH || openphases[depth] < 0)
+    {
+        return;
+    }
+
+    phase = &phases[openphases[depth]];
+    phase->wall = WallTime() - basetime - phase->start;
+    phase->cpu = CPUTime() - phase->cpu;
+    phase->zonebytes = ZoneBytes() - phase->zonebytes;
+    phase->done = true;
+}
+
+static void WriteTrace(void)
+{
+    FILE *f;
+    phase_t *phase;
+    boolean first;
+    int i;
+
+    f = fopen(tracefile, "w");
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "M_ProfilePrint: Unable to write %s\n", tracefile);
+        return;
+    }
+
+    fprintf(f, "{\"traceEvents\": [");
+    first = true;
+
+    for (i = 0; i < numphases; ++i)
+    {
+        phase = &phases[i];
+
+        if (!phase->done)
+        {
+            continue;
+        }
+
+        fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", "
+                   "\"ts\": %u, \"dur\": %u, \"pid\": 1, \"tid\": 1, "
+                   "\"args\": {\"cpu_us\": %u, \"zone_bytes\": %u}}",
+                first ? "" : ",", phase->name,
+                phase->start, phase->wall, phase->cpu, phase->zonebytes);
+        first = false;
+    }
+
+    fprintf(f, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    fclose(f);
+}
+
+void M_ProfilePrint(void)
+{
+    phase_t *phase;
+    int indent;
+
+    if (!profiling || printedphases == numphases)
+    {
+        return;
+    }
+
+    printf("\n%-40s %10s %10s %10s\n", "Phase", "Wall ms", "CPU ms", "Zone KB");
+
+    for (; printedphases < numphases; ++printedphases)
+    {
+        phase = &phases[printedphases];
+        indent = phase->depth * 2;
+
+        if (phase->done)
+        {
+            printf("%*s%-*s %6u.%03u %6u.%03u %10u\n",
+                   indent, "", 40 - indent, phase->name,
+                   phase->wall / 1000, phase->wall % 1000,
+                   phase->cpu / 1000, phase->cpu % 1000,
+                   phase->zonebytes / 1024);
+        }
+        else
+        {
+            printf("%*s%-*s %10s\n", indent, "", 40 - indent,
+                   phase->name, "unfinished");
+        }
+    }
+
+    printf("\n");
+
+    if (tracefile != NULL)
+    {
+        WriteTrace();
+    }
+}
+
@@ -0,0 +1,36 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//      Timing of startup and level loading (-profile-startup).
+//
+
+
+#ifndef __M_PROFILE__
+#define __M_PROFILE__
+
+void M_ProfileInit(void);
+
+// Phases nest. All of these do nothing unless profiling.
+
+void M_ProfileBegin(const char *name);
+void M_ProfileEnd(void);
+
+// Prints the phases ended since the last call and rewrites
+// the trace file, if any.
+
+void M_ProfilePrint(void);
+
+#endif
+
@@ -24,6 +24,8 @@
 #include "r_local.h"
 #endif
 
+#include "z_zone.h"
+
 #define FLOATSPEED		(FRACUNIT*4)
 
 
@@ -66,8 +68,20 @@
 // both the head and tail of the thinker list
 extern	thinker_t	thinkercap;	
 
+// pools the thinkers are allocated from
+extern	zpool_t		mobjpool;
+extern	zpool_t		ceilingpool;
+extern	zpool_t		doorpool;
+extern	zpool_t		floorpool;
+extern	zpool_t		platpool;
+extern	zpool_t		flickerpool;
+extern	zpool_t		flashpool;
+extern	zpool_t		strobepool;
+extern	zpool_t		glowpool;
+
 
 void P_InitThinkers (void);
+void P_ClearThinkerPools (void);
 void P_AddThinker (thinker_t* thinker);
 void P_RemoveThinker (thinker_t* thinker);
 
@@ -27,6 +27,8 @@
 #include "i_swap.h"
 #include "m_argv.h"
 #include "m_bbox.h"
+#include "m_misc.h"
+#include "m_profile.h"
 
 #include "g_game.h"
 
@@ -737,6 +739,34 @@ static void P_LoadReject(int lumpnum)
     }
 }
 
+//
+// P_MapLumpName
+// Finds the name of the map's marker lump.
+// lumpname needs room for 9 characters.
+//
+void
+P_MapLumpName
+( int		episode,
+  int		map,
+  char*		lumpname )
+{
+    if ( gamemode == commercial)
+    {
+	if (map<10)
+	    DEH_snprintf(lumpname, 9, "map0%i", map);
+	else
+	    DEH_snprintf(lumpname, 9, "map%i", map);
+    }
+    else
+    {
+	lumpname[0] = 'E';
+	lumpname[1] = '0' + episode;
+	lumpname[2] = 'M';
+	lumpname[3] = '0' + map;
+	lumpname[4] = 0;
+    }
+}
+
 //
 // P_SetupLevel
 //
@@ -750,7 +780,14 @@ P_SetupLevel
     int		i;
     char	lumpname[9];
     int		lumpnum;
+    char	phasename[32];
 	
+    // find map name
+    P_MapLumpName (episode, map, lumpname);
+
+    M_snprintf (phasename, sizeof(phasename), "P_SetupLevel %s", lumpname);
+    M_ProfileBegin (phasename);
+
     totalkills = totalitems = totalsecret = wminfo.maxfrags = 0;
     wminfo.partime = 180;
     for (i=0 ; i<MAXPLAYERS ; i++)
@@ -766,49 +803,60 @@ P_SetupLevel
     // Make sure all sounds are stopped before Z_FreeTags.
     S_Start ();			
 
+    M_ProfileBegin ("Z_FreeTags");
     Z_FreeTags (PU_LEVEL, PU_PURGELEVEL-1);
+    P_ClearThinkerPools ();
+    M_ProfileEnd ();
 
     // UNUSED W_Profile ();
     P_InitThinkers ();
-	   
-    // find map name
-    if ( gamemode == commercial)
-    {
-	if (map<10)
-	    DEH_snprintf(lumpname, 9, "map0%i", map);
-	else
-	    DEH_snprintf(lumpname, 9, "map%i", map);
-    }
-    else
-    {
-	lumpname[0] = 'E';
-	lumpname[1] = '0' + episode;
-	lumpname[2] = 'M';
-	lumpname[3] = '0' + map;
-	lumpname[4] = 0;
-    }
 
     lumpnum = W_GetNumForName (lumpname);
+
+    // the level's lumps are all read in just below
+    W_PrefetchLumps (lumpnum, ML_BLOCKMAP + 1);
 	
     leveltime = 0;
 	
     // note: most of this ordering is important	
+    M_ProfileBegin ("P_LoadBlockMap");
     P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadVertexes");
     P_LoadVertexes (lumpnum+ML_VERTEXES);
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadSectors");
     P_LoadSectors (lumpnum+ML_SECTORS);
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadSideDefs");
     P_LoadSideDefs (lumpnum+ML_SIDEDEFS);
+    M_ProfileEnd ();
 
+    M_ProfileBegin ("P_LoadLineDefs");
     P_LoadLineDefs (lumpnum+ML_LINEDEFS);
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadSubsectors");
     P_LoadSubsectors (lumpnum+ML_SSECTORS);
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadNodes");
     P_LoadNodes (lumpnum+ML_NODES);
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadSegs");
     P_LoadSegs (lumpnum+ML_SEGS);
+    M_ProfileEnd ();
 
+    M_ProfileBegin ("P_GroupLines");
     P_GroupLines ();
+    M_ProfileEnd ();
+    M_ProfileBegin ("P_LoadReject");
     P_LoadReject (lumpnum+ML_REJECT);
+    M_ProfileEnd ();
 
     bodyqueslot = 0;
     deathmatch_p = deathmatchstarts;
+    M_ProfileBegin ("P_LoadThings");
     P_LoadThings (lumpnum+ML_THINGS);
+    M_ProfileEnd ();
     
     // if deathmatch, randomly spawn the active players
     if (deathmatch)
@@ -826,14 +874,22 @@ P_SetupLevel
     iquehead = iquetail = 0;		
 	
     // set up world state
+    M_ProfileBegin ("P_SpawnSpecials");
     P_SpawnSpecials ();
+    M_ProfileEnd ();
 	
     // build subsector connect matrix
     //	UNUSED P_ConnectSubsectors ();
 
     // preload graphics
     if (precache)
+    {
+	M_ProfileBegin ("R_PrecacheLevel");
 	R_PrecacheLevel ();
+	M_ProfileEnd ();
+    }
+
+    M_ProfileEnd ();
 
     //printf ("free memory: 0x%x\n", Z_FreeMemory());
 
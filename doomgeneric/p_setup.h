@@ -23,6 +23,12 @@
 
 
 
+void
+P_MapLumpName
+( int		episode,
+  int		map,
+  char*		lumpname );
+
 // NOT called by W_Ticker. Fixme.
 void
 P_SetupLevel
@@ -28,8 +28,8 @@ int	leveltime;
 
 //
 // THINKERS
-// All thinkers should be allocated by Z_Malloc
-// so they can be operated on uniformly.
+// All thinkers should be allocated from one of the
+// pools below so they can be operated on uniformly.
 // The actual structures will vary in size,
 // but the first element must be thinker_t.
 //
@@ -39,6 +39,36 @@ int	leveltime;
 // Both the head and tail of the thinker list.
 thinker_t	thinkercap;
 
+// One pool per kind of thinker, so each kind is packed
+//  together instead of strewn across the zone.
+zpool_t		mobjpool = { sizeof(mobj_t), 64, PU_LEVEL };
+zpool_t		ceilingpool = { sizeof(ceiling_t), 16, PU_LEVSPEC };
+zpool_t		doorpool = { sizeof(vldoor_t), 16, PU_LEVSPEC };
+zpool_t		floorpool = { sizeof(floormove_t), 16, PU_LEVSPEC };
+zpool_t		platpool = { sizeof(plat_t), 16, PU_LEVSPEC };
+zpool_t		flickerpool = { sizeof(fireflicker_t), 16, PU_LEVSPEC };
+zpool_t		flashpool = { sizeof(lightflash_t), 16, PU_LEVSPEC };
+zpool_t		strobepool = { sizeof(strobe_t), 16, PU_LEVSPEC };
+zpool_t		glowpool = { sizeof(glow_t), 16, PU_LEVSPEC };
+
+
+//
+// P_ClearThinkerPools
+// Call whenever the level's zone blocks are freed.
+//
+void P_ClearThinkerPools (void)
+{
+    Z_ClearPool (&mobjpool);
+    Z_ClearPool (&ceilingpool);
+    Z_ClearPool (&doorpool);
+    Z_ClearPool (&floorpool);
+    Z_ClearPool (&platpool);
+    Z_ClearPool (&flickerpool);
+    Z_ClearPool (&flashpool);
+    Z_ClearPool (&strobepool);
+    Z_ClearPool (&glowpool);
+}
+
 
 //
 // P_InitThinkers
@@ -103,7 +133,7 @@ void P_RunThinkers (void)
 	    // time to remove it
 	    currentthinker->next->prev = currentthinker->prev;
 	    currentthinker->prev->next = currentthinker->next;
-	    Z_Free (currentthinker);
+	    Z_PoolFree (currentthinker);
 	}
 	else
 	{
@@ -28,6 +28,7 @@
 #include "r_main.h"
 #include "r_plane.h"
 #include "r_things.h"
+#include "r_walk.h"
 
 // State.
 #include "doomstat.h"
@@ -37,14 +38,16 @@
 
 
 
-seg_t*		curline;
-side_t*		sidedef;
-line_t*		linedef;
-sector_t*	frontsector;
-sector_t*	backsector;
+R_THREADLOCAL seg_t*		curline;
+R_THREADLOCAL side_t*		sidedef;
+R_THREADLOCAL line_t*		linedef;
+R_THREADLOCAL sector_t*	frontsector;
+R_THREADLOCAL sector_t*	backsector;
 
-drawseg_t	drawsegs[MAXDRAWSEGS];
-drawseg_t*	ds_p;
+// Grows as needed in R_StoreWallRange and is reused between frames.
+R_THREADLOCAL drawseg_t*	drawsegs;
+R_THREADLOCAL drawseg_t*	ds_p;
+R_THREADLOCAL int		maxdrawsegs;
 
 
 void
@@ -78,11 +81,13 @@ typedef	struct
 } cliprange_t;
 
 
-#define MAXSEGS		32
+// Solid ranges never touch, so the screen holds at most MAXWIDTH/2 of
+//  them plus the two sentinels. One more is inserted before merging.
+#define MAXSEGS		(MAXWIDTH/2+3)
 
 // newend is one past the last valid seg
-cliprange_t*	newend;
-cliprange_t	solidsegs[MAXSEGS];
+R_THREADLOCAL cliprange_t*	newend;
+R_THREADLOCAL cliprange_t	solidsegs[MAXSEGS];
 
 
 
@@ -508,6 +513,13 @@ void R_Subsector (int num)
     count = sub->numlines;
     line = &segs[sub->firstline];
 
+    if (r_singlewalk)
+    {
+	// this subsector's planes are drawn on their own
+	R_WalkSubsector (num);
+    }
+    else
+    {
     if (frontsector->floorheight < viewz)
     {
 	floorplane = R_FindPlane (frontsector->floorheight,
@@ -526,6 +538,7 @@ void R_Subsector (int num)
     }
     else
 	ceilingplane = NULL;
+    }
 		
     R_AddSprites (frontsector);	
 
@@ -534,6 +547,9 @@ void R_Subsector (int num)
 	R_AddLine (line);
 	line++;
     }
+
+    if (r_singlewalk)
+	R_WalkDrawPlanes ();
 }
 
 
@@ -22,25 +22,26 @@
 
 
 
-extern seg_t*		curline;
-extern side_t*		sidedef;
-extern line_t*		linedef;
-extern sector_t*	frontsector;
-extern sector_t*	backsector;
+extern R_THREADLOCAL seg_t*		curline;
+extern R_THREADLOCAL side_t*		sidedef;
+extern R_THREADLOCAL line_t*		linedef;
+extern R_THREADLOCAL sector_t*	frontsector;
+extern R_THREADLOCAL sector_t*	backsector;
 
-extern int		rw_x;
-extern int		rw_stopx;
+extern R_THREADLOCAL int		rw_x;
+extern R_THREADLOCAL int		rw_stopx;
 
-extern boolean		segtextured;
+extern R_THREADLOCAL boolean		segtextured;
 
 // false if the back side is the same plane
-extern boolean		markfloor;		
-extern boolean		markceiling;
+extern R_THREADLOCAL boolean		markfloor;		
+extern R_THREADLOCAL boolean		markceiling;
 
 extern boolean		skymap;
 
-extern drawseg_t	drawsegs[MAXDRAWSEGS];
-extern drawseg_t*	ds_p;
+extern R_THREADLOCAL drawseg_t*	drawsegs;
+extern R_THREADLOCAL drawseg_t*	ds_p;
+extern R_THREADLOCAL int		maxdrawsegs;
 
 extern lighttable_t**	hscalelight;
 extern lighttable_t**	vscalelight;
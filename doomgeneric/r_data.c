@@ -18,6 +18,20 @@
 //
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_MKSTEMP
+#include <unistd.h>
+#endif
 
 #include "deh_main.h"
 #include "i_swap.h"
@@ -26,11 +40,14 @@
 
 
 #include "w_wad.h"
+#include "w_checksum.h"
 
 #include "doomdef.h"
 #include "m_misc.h"
+#include "m_profile.h"
 #include "r_local.h"
 #include "p_local.h"
+#include "p_setup.h"
 
 #include "doomstat.h"
 #include "r_sky.h"
@@ -38,6 +55,10 @@
 
 #include "r_data.h"
 
+#ifdef R_THREADS
+#include <pthread.h>
+#endif
+
 //
 // Graphics.
 // DOOM graphics for walls and sprites
@@ -107,6 +128,7 @@ struct texture_s
 {
     // Keep name for switch changing, etc.
     char	name[8];		
+    uint64_t	key;		// W_LumpNameKey(name)
     short	width;
     short	height;
 
@@ -217,6 +239,69 @@ R_DrawColumnInCache
 
 
 
+//
+// When rendering on several threads, the zone is shared
+// between them so all renderer access to cached lumps and
+// textures is serialized. Anything a thread touches is held
+// as PU_STATIC until the frame is done, so that another
+// thread can't purge it while it's still being drawn.
+// Deferred drawing (see r_draw.c) holds them too, since the
+// columns and spans are drawn after more has been cached.
+//
+#ifdef R_THREADS
+static pthread_mutex_t	cachelock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static boolean		holdlumps;
+
+static byte*		lumpisheld;	// [numlumps]
+static int*		heldlumps;
+static int		numheldlumps;
+
+static byte*		compositeisheld;	// [numtextures]
+static int*		heldcomposites;
+static int		numheldcomposites;
+
+// Baked texture data (see R_OpenBakedData.)
+boolean			r_bakedata;
+
+static byte*		bake;		// the whole file, or NULL
+static int		bakesize;
+static boolean		texturesbaked;	// composites point into bake
+static sha1_digest_t	bakesum;	// of the WADs, when r_bakedata
+
+static void R_LockCache (void)
+{
+#ifdef R_THREADS
+    if (r_numthreads > 1)
+	pthread_mutex_lock(&cachelock);
+#endif
+}
+
+static void R_UnlockCache (void)
+{
+#ifdef R_THREADS
+    if (r_numthreads > 1)
+	pthread_mutex_unlock(&cachelock);
+#endif
+}
+
+//
+// R_HoldLump
+// Called with the cache lock held.
+//
+static void* R_HoldLump (int lump)
+{
+    if (!lumpisheld[lump])
+    {
+	lumpisheld[lump] = true;
+	heldlumps[numheldlumps++] = lump;
+    }
+    return W_CacheLumpNum (lump, PU_STATIC);
+}
+
+
+
 //
 // R_GenerateComposite
 // Using the texture definition,
@@ -253,6 +338,11 @@ void R_GenerateComposite (int texnum)
 	 i<texture->patchcount;
 	 i++, patch++)
     {
+	// Caching the patch as PU_CACHE would let it be purged
+	//  while another thread is drawing from it.
+	if (holdlumps)
+	    realpatch = R_HoldLump (patch->patch);
+	else
 	realpatch = W_CacheLumpNum (patch->patch, PU_CACHE);
 	x1 = patch->originx;
 	x2 = x1 + SHORT(realpatch->width);
@@ -392,7 +482,30 @@ R_GetColumn
     ofs = texturecolumnofs[tex][col];
     
     if (lump > 0)
-	return (byte *)W_CacheLumpNum(lump,PU_CACHE)+ofs;
+	return (byte *)R_CacheLumpNum(lump,PU_CACHE)+ofs;
+
+    // baked composites are never purged
+    if (texturesbaked)
+	return texturecomposite[tex] + ofs;
+
+    if (holdlumps)
+    {
+	byte* composite;
+
+	R_LockCache ();
+	if (!texturecomposite[tex])
+	    R_GenerateComposite (tex);
+	if (!compositeisheld[tex])
+	{
+	    Z_ChangeTag (texturecomposite[tex], PU_STATIC);
+	    compositeisheld[tex] = true;
+	    heldcomposites[numheldcomposites++] = tex;
+	}
+	composite = texturecomposite[tex];
+	R_UnlockCache ();
+
+	return composite + ofs;
+    }
 
     if (!texturecomposite[tex])
 	R_GenerateComposite (tex);
@@ -401,6 +514,500 @@ R_GetColumn
 }
 
 
+
+//
+// R_CacheLumpNum
+// Renderer access to cached lumps, e.g. sprites and flats.
+// When rendering on several threads or deferring drawing, the
+//  lump is held until R_ReleaseHeldLumps instead of being tagged.
+//
+void* R_CacheLumpNum (int lump, int tag)
+{
+    if (holdlumps)
+    {
+	void* data;
+
+	R_LockCache ();
+	data = R_HoldLump (lump);
+	R_UnlockCache ();
+	return data;
+    }
+
+    return W_CacheLumpNum (lump, tag);
+}
+
+//
+// R_ReleaseLumpNum
+// Releases a lump cached with R_CacheLumpNum as PU_STATIC.
+//
+void R_ReleaseLumpNum (int lump)
+{
+    // held lumps are released when the frame is done
+    if (holdlumps)
+	return;
+
+    W_ReleaseLumpNum (lump);
+}
+
+//
+// R_ReleaseHeldLumps
+// Called once all render threads have finished the frame.
+// Everything they held goes back to being purgable.
+//
+void R_ReleaseHeldLumps (void)
+{
+    int		i;
+
+    for (i=0 ; i<numheldlumps ; i++)
+    {
+	lumpisheld[heldlumps[i]] = false;
+	W_ReleaseLumpNum (heldlumps[i]);
+    }
+    numheldlumps = 0;
+
+    for (i=0 ; i<numheldcomposites ; i++)
+    {
+	compositeisheld[heldcomposites[i]] = false;
+	Z_ChangeTag (texturecomposite[heldcomposites[i]], PU_CACHE);
+    }
+    numheldcomposites = 0;
+}
+
+
+
+//
+// BAKED TEXTURE DATA
+// With r_bakedata, the texture column lookups and composites,
+//  the sprite sizes and the sprite frame tables are saved to a
+//  file in the user's cache directory, named after the checksum
+//  of the loaded WADs. Later runs with the same WADs use the file
+//  as is instead of working it all out again. Where it can, the
+//  file is mapped read-only, so its pages are shared by every
+//  game using the same WADs.
+// The file is in native byte order and native struct layout, so
+//  it's only used by the build that wrote it; any other build, or
+//  a file that doesn't match, just writes it again.
+//
+#define BAKE_MAGIC	"DOOMBAKE"
+#define BAKE_VERSION	2
+#define BAKE_BYTEORDER	0x01020304
+
+#if defined(__DATE__) && defined(__TIME__)
+#define BAKE_BUILD	PACKAGE_STRING " " __DATE__ " " __TIME__
+#else
+#define BAKE_BUILD	PACKAGE_STRING
+#endif
+
+typedef struct
+{
+    char		magic[8];
+    int			version;
+    int			byteorder;
+    char		build[48];
+    sha1_digest_t	wadsum;
+    int			numtextures;
+    int			numspritelumps;
+    int			spriteofs;	// widths, offsets, top offsets
+    int			numsprites;
+    int			spritedefofs;	// bakesprite_t[numsprites]
+    int			size;		// of the whole file
+} bakeheader_t;
+
+// Follows the header for each texture. Offsets are from the
+//  start of the file.
+typedef struct
+{
+    int			width;
+    int			compositesize;
+    int			columnlump;	// short[width]
+    int			columnofs;	// unsigned short[width]
+    int			composite;
+} baketexture_t;
+
+// One for each sprite name, with its spriteframe_t[numframes].
+typedef struct
+{
+    char		name[4];
+    int			numframes;
+    int			frames;
+} bakesprite_t;
+
+
+//
+// R_BakePath
+// Returns the path to the baked data for these WADs, which
+//  must be freed, or NULL if there's nowhere to put it.
+//
+static char* R_BakePath (sha1_digest_t wadsum, boolean create)
+{
+    char*	base;
+    char*	dir;
+    char*	path;
+    char	name[sizeof(sha1_digest_t) * 2 + 1];
+    char*	env;
+    int		i;
+
+    env = getenv ("XDG_CACHE_HOME");
+    if (env != NULL && *env)
+	base = M_StringDuplicate (env);
+    else if ((env = getenv ("HOME")) != NULL && *env)
+	base = M_StringJoin (env, DIR_SEPARATOR_S, ".cache", NULL);
+    else
+	return NULL;
+
+    dir = M_StringJoin (base, DIR_SEPARATOR_S, "doom-cli", NULL);
+    if (create)
+    {
+	M_MakeDirectory (base);
+	M_MakeDirectory (dir);
+    }
+
+    for (i=0 ; i<sizeof(sha1_digest_t) ; i++)
+	M_snprintf (name + i*2, 3, "%02x", wadsum[i]);
+
+    path = M_StringJoin (dir, DIR_SEPARATOR_S, name, ".bin", NULL);
+    free (dir);
+    free (base);
+    return path;
+}
+
+static void R_CloseBakedData (void)
+{
+#ifdef HAVE_MMAP
+    munmap (bake, bakesize);
+#else
+    Z_Free (bake);
+#endif
+    bake = NULL;
+    bakesize = 0;
+}
+
+//
+// R_OpenBakedData
+// Loads the baked data for these WADs if there is any.
+// Whether it fits the textures and sprites is checked as
+//  they're set up.
+//
+static void R_OpenBakedData (sha1_digest_t wadsum)
+{
+    char*		path;
+    bakeheader_t*	header;
+
+    path = R_BakePath (wadsum, false);
+    if (path == NULL)
+	return;
+
+#ifdef HAVE_MMAP
+    {
+	int		handle;
+	struct stat	st;
+	void*		data;
+
+	handle = open (path, O_RDONLY);
+	if (handle >= 0)
+	{
+	    if (fstat (handle, &st) == 0 && st.st_size >= sizeof(bakeheader_t)
+		&& st.st_size < 0x7fffffff)
+	    {
+		data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, handle, 0);
+		if (data != MAP_FAILED)
+		{
+		    bake = data;
+		    bakesize = st.st_size;
+		}
+	    }
+	    close (handle);
+	}
+    }
+#else
+    if (M_FileExists (path))
+    {
+	bakesize = M_ReadFile (path, &bake);
+	if (bakesize < sizeof(bakeheader_t))
+	    R_CloseBakedData ();
+    }
+#endif
+
+    free (path);
+
+    if (bake == NULL)
+	return;
+
+    header = (bakeheader_t*) bake;
+    if (memcmp (header->magic, BAKE_MAGIC, sizeof(header->magic))
+	|| header->version != BAKE_VERSION
+	|| header->byteorder != BAKE_BYTEORDER
+	|| strncmp (header->build, BAKE_BUILD, sizeof(header->build))
+	|| memcmp (header->wadsum, wadsum, sizeof(sha1_digest_t))
+	|| header->size != bakesize)
+    {
+	R_CloseBakedData ();
+    }
+}
+
+//
+// R_UseBakedTextures
+// Points the texture lookups and composites into the baked
+//  data. Returns false if there isn't any or it doesn't fit.
+//
+static boolean R_UseBakedTextures (void)
+{
+    bakeheader_t*	header;
+    baketexture_t*	entry;
+    int			i;
+
+    if (bake == NULL)
+	return false;
+
+    header = (bakeheader_t*) bake;
+    if (header->numtextures != numtextures
+	|| sizeof(*header) + numtextures * sizeof(*entry) > bakesize)
+	return false;
+
+    entry = (baketexture_t*) (bake + sizeof(*header));
+    for (i=0 ; i<numtextures ; i++, entry++)
+    {
+	if (entry->width != textures[i]->width
+	    || entry->columnlump < 0
+	    || entry->columnlump + entry->width * 2 > bakesize
+	    || entry->columnofs < 0
+	    || entry->columnofs + entry->width * 2 > bakesize
+	    || entry->compositesize < 0
+	    || entry->composite < 0
+	    || entry->composite + entry->compositesize > bakesize)
+	    return false;
+    }
+
+    entry = (baketexture_t*) (bake + sizeof(*header));
+    for (i=0 ; i<numtextures ; i++, entry++)
+    {
+	texturecolumnlump[i] = (short*) (bake + entry->columnlump);
+	texturecolumnofs[i] = (unsigned short*) (bake + entry->columnofs);
+	texturecompositesize[i] = entry->compositesize;
+	texturecomposite[i] = bake + entry->composite;
+    }
+
+    texturesbaked = true;
+    return true;
+}
+
+//
+// R_UseBakedSprites
+// Same for the sprite sizes.
+//
+static boolean R_UseBakedSprites (void)
+{
+    bakeheader_t*	header;
+    fixed_t*		sizes;
+
+    if (bake == NULL || !texturesbaked)
+	return false;
+
+    header = (bakeheader_t*) bake;
+    if (header->numspritelumps != numspritelumps
+	|| header->spriteofs < 0
+	|| header->spriteofs + 3 * numspritelumps * sizeof(fixed_t) > bakesize)
+	return false;
+
+    sizes = (fixed_t*) (bake + header->spriteofs);
+    spritewidth = sizes;
+    spriteoffset = sizes + numspritelumps;
+    spritetopoffset = sizes + numspritelumps * 2;
+    return true;
+}
+
+//
+// R_UseBakedSpriteDefs
+// And the sprite frames, if the sprite names are the same.
+//
+boolean R_UseBakedSpriteDefs (char** namelist)
+{
+    bakeheader_t*	header;
+    bakesprite_t*	entry;
+    int			i;
+
+    if (bake == NULL || !texturesbaked)
+	return false;
+
+    header = (bakeheader_t*) bake;
+    if (header->numsprites != numsprites
+	|| header->spritedefofs < 0
+	|| header->spritedefofs + numsprites * sizeof(*entry) > bakesize)
+	return false;
+
+    entry = (bakesprite_t*) (bake + header->spritedefofs);
+    for (i=0 ; i<numsprites ; i++, entry++)
+    {
+	if (strncasecmp (entry->name, DEH_String(namelist[i]), 4)
+	    || entry->numframes < 0
+	    || entry->frames < 0
+	    || entry->frames + entry->numframes * sizeof(spriteframe_t)
+	       > bakesize)
+	    return false;
+    }
+
+    entry = (bakesprite_t*) (bake + header->spritedefofs);
+    for (i=0 ; i<numsprites ; i++, entry++)
+    {
+	sprites[i].numframes = entry->numframes;
+	sprites[i].spriteframes = (spriteframe_t*) (bake + entry->frames);
+    }
+
+    return true;
+}
+
+//
+// R_WriteBakedData
+// Saves everything for next time, compositing every texture
+//  on the way. It's written under a temporary name of its own
+//  and then renamed, so that no other game can see it half
+//  done or write into it at the same time.
+//
+static void R_WriteBakedData (sha1_digest_t wadsum, char** namelist)
+{
+    char*		path;
+    char*		temppath;
+    FILE*		file;
+    byte*		tables;
+    bakeheader_t*	header;
+    baketexture_t*	entry;
+    bakesprite_t*	sprite;
+    int			tablesize;
+    int			ofs;
+    int			i;
+    boolean		ok;
+
+    // Lay out the file: the header and the texture entries, the
+    //  column lookups, the sprite sizes, the sprite frames, and
+    //  then the composites.
+    ofs = sizeof(*header) + numtextures * sizeof(*entry);
+    for (i=0 ; i<numtextures ; i++)
+	ofs += textures[i]->width * 2 + ((textures[i]->width * 2 + 3) & ~3);
+    ofs += 3 * numspritelumps * sizeof(fixed_t);
+    ofs += numsprites * sizeof(*sprite);
+    for (i=0 ; i<numsprites ; i++)
+	ofs += sprites[i].numframes * sizeof(spriteframe_t);
+    tablesize = ofs;
+
+    tables = Z_Malloc (tablesize, PU_STATIC, NULL);
+    memset (tables, 0, tablesize);
+
+    header = (bakeheader_t*) tables;
+    entry = (baketexture_t*) (tables + sizeof(*header));
+    ofs = sizeof(*header) + numtextures * sizeof(*entry);
+    for (i=0 ; i<numtextures ; i++, entry++)
+    {
+	entry->width = textures[i]->width;
+	entry->compositesize = texturecompositesize[i];
+	entry->columnlump = ofs;
+	memcpy (tables + ofs, texturecolumnlump[i], entry->width * 2);
+	ofs += entry->width * 2;
+	entry->columnofs = ofs;
+	memcpy (tables + ofs, texturecolumnofs[i], entry->width * 2);
+	ofs += (entry->width * 2 + 3) & ~3;
+    }
+
+    header->spriteofs = ofs;
+    memcpy (tables + ofs, spritewidth, numspritelumps * sizeof(fixed_t));
+    ofs += numspritelumps * sizeof(fixed_t);
+    memcpy (tables + ofs, spriteoffset, numspritelumps * sizeof(fixed_t));
+    ofs += numspritelumps * sizeof(fixed_t);
+    memcpy (tables + ofs, spritetopoffset, numspritelumps * sizeof(fixed_t));
+    ofs += numspritelumps * sizeof(fixed_t);
+
+    header->spritedefofs = ofs;
+    sprite = (bakesprite_t*) (tables + ofs);
+    ofs += numsprites * sizeof(*sprite);
+    for (i=0 ; i<numsprites ; i++, sprite++)
+    {
+	memcpy (sprite->name, DEH_String(namelist[i]), 4);
+	sprite->numframes = sprites[i].numframes;
+	sprite->frames = ofs;
+	memcpy (tables + ofs, sprites[i].spriteframes,
+		sprites[i].numframes * sizeof(spriteframe_t));
+	ofs += sprites[i].numframes * sizeof(spriteframe_t);
+    }
+
+    entry = (baketexture_t*) (tables + sizeof(*header));
+    for (i=0 ; i<numtextures ; i++, entry++)
+    {
+	entry->composite = ofs;
+	ofs += entry->compositesize;
+    }
+
+    memcpy (header->magic, BAKE_MAGIC, sizeof(header->magic));
+    header->version = BAKE_VERSION;
+    header->byteorder = BAKE_BYTEORDER;
+    M_StringCopy (header->build, BAKE_BUILD, sizeof(header->build));
+    memcpy (header->wadsum, wadsum, sizeof(sha1_digest_t));
+    header->numtextures = numtextures;
+    header->numspritelumps = numspritelumps;
+    header->numsprites = numsprites;
+    header->size = ofs;
+
+    path = R_BakePath (wadsum, true);
+    if (path == NULL)
+    {
+	Z_Free (tables);
+	return;
+    }
+#ifdef HAVE_MKSTEMP
+    {
+	int	handle;
+
+	temppath = M_StringJoin (path, ".XXXXXX", NULL);
+	handle = mkstemp (temppath);
+	file = NULL;
+	if (handle >= 0)
+	{
+	    file = fdopen (handle, "wb");
+	    if (file == NULL)
+	    {
+		close (handle);
+		remove (temppath);
+	    }
+	}
+    }
+#else
+    temppath = M_StringJoin (path, ".tmp", NULL);
+    file = fopen (temppath, "wb");
+#endif
+    ok = file != NULL;
+    if (ok)
+    {
+	ok = fwrite (tables, 1, tablesize, file) == tablesize;
+
+	// Each composite is written as soon as it's made, since
+	//  it's purgable from then on.
+	for (i=0 ; ok && i<numtextures ; i++)
+	{
+	    if (!texturecompositesize[i])
+		continue;
+	    if (!texturecomposite[i])
+		R_GenerateComposite (i);
+	    ok = fwrite (texturecomposite[i], 1, texturecompositesize[i], file)
+		== texturecompositesize[i];
+	}
+
+	if (fclose (file) != 0)
+	    ok = false;
+    }
+
+    if (ok && rename (temppath, path) == 0)
+	printf ("\nR_InitData: Saved texture data to %s\n", path);
+    else
+    {
+	printf ("\nR_InitData: Couldn't save texture data to %s\n", path);
+	if (file != NULL)
+	    remove (temppath);
+    }
+
+    free (temppath);
+    free (path);
+    Z_Free (tables);
+}
+
+
 static void GenerateTextureHashTable(void)
 {
     texture_t **rover;
@@ -426,7 +1033,7 @@ static void GenerateTextureHashTable(void)
         // wins. The new entry must therefore be added at the end
         // of the hash chain, so that earlier entries win.
 
-        key = W_LumpNameHash(textures[i]->name) % numtextures;
+        key = W_LumpKeyHash(textures[i]->key) % numtextures;
 
         rover = &textures_hashtable[key];
 
@@ -578,6 +1185,7 @@ void R_InitTextures (void)
 	texture->patchcount = SHORT(mtexture->patchcount);
 	
 	memcpy (texture->name, mtexture->name, sizeof(texture->name));
+	texture->key = W_LumpNameKey (texture->name);
 	mpatch = &mtexture->patches[0];
 	patch = &texture->patches[0];
 
@@ -592,8 +1200,6 @@ void R_InitTextures (void)
 			 texture->name);
 	    }
 	}		
-	texturecolumnlump[i] = Z_Malloc (texture->width*sizeof(**texturecolumnlump), PU_STATIC,0);
-	texturecolumnofs[i] = Z_Malloc (texture->width*sizeof(**texturecolumnofs), PU_STATIC,0);
 
 	j = 1;
 	while (j*2 <= texture->width)
@@ -613,8 +1219,16 @@ void R_InitTextures (void)
     
     // Precalculate whatever possible.	
 
-    for (i=0 ; i<numtextures ; i++)
-	R_GenerateLookup (i);
+    if (!R_UseBakedTextures ())
+    {
+	for (i=0 ; i<numtextures ; i++)
+	{
+	    texture = textures[i];
+	    texturecolumnlump[i] = Z_Malloc (texture->width*sizeof(**texturecolumnlump), PU_STATIC,0);
+	    texturecolumnofs[i] = Z_Malloc (texture->width*sizeof(**texturecolumnofs), PU_STATIC,0);
+	    R_GenerateLookup (i);
+	}
+    }
     
     // Create translation table for global animation.
     texturetranslation = Z_Malloc ((numtextures+1)*sizeof(*texturetranslation), PU_STATIC, 0);
@@ -661,6 +1275,10 @@ void R_InitSpriteLumps (void)
     lastspritelump = W_GetNumForName (DEH_String("S_END")) - 1;
     
     numspritelumps = lastspritelump - firstspritelump + 1;
+
+    if (R_UseBakedSprites ())
+	return;
+
     spritewidth = Z_Malloc (numspritelumps*sizeof(*spritewidth), PU_STATIC, 0);
     spriteoffset = Z_Malloc (numspritelumps*sizeof(*spriteoffset), PU_STATIC, 0);
     spritetopoffset = Z_Malloc (numspritelumps*sizeof(*spritetopoffset), PU_STATIC, 0);
@@ -679,6 +1297,27 @@ void R_InitSpriteLumps (void)
 
 
 
+//
+// R_SaveBakedData
+// Called once the sprites are set up as well. If there was no
+//  baked data, or it didn't fit, it's written now.
+//
+void R_SaveBakedData (char** namelist)
+{
+    if (!r_bakedata || texturesbaked)
+	return;
+
+    M_ProfileBegin ("R_WriteBakedData");
+    if (bake != NULL)
+	R_CloseBakedData ();
+    R_WriteBakedData (bakesum, namelist);
+
+    // Compositing held the patches, and there's no frame to
+    //  release them.
+    R_ReleaseHeldLumps ();
+    M_ProfileEnd ();
+}
+
 //
 // R_InitColormaps
 //
@@ -702,13 +1341,43 @@ void R_InitColormaps (void)
 //
 void R_InitData (void)
 {
+    if (r_bakedata)
+    {
+	M_ProfileBegin ("R_OpenBakedData");
+	W_Checksum (bakesum);
+	R_OpenBakedData (bakesum);
+	M_ProfileEnd ();
+    }
+
+    M_ProfileBegin ("R_InitTextures");
     R_InitTextures ();
+    M_ProfileEnd ();
     printf (".");
+    M_ProfileBegin ("R_InitFlats");
     R_InitFlats ();
+    M_ProfileEnd ();
     printf (".");
+    M_ProfileBegin ("R_InitSpriteLumps");
     R_InitSpriteLumps ();
+    M_ProfileEnd ();
     printf (".");
+    M_ProfileBegin ("R_InitColormaps");
     R_InitColormaps ();
+    M_ProfileEnd ();
+
+    holdlumps = r_numthreads > 1 || r_deferred;
+
+    if (holdlumps)
+    {
+	lumpisheld = Z_Malloc (numlumps, PU_STATIC, 0);
+	heldlumps = Z_Malloc (numlumps * sizeof(*heldlumps), PU_STATIC, 0);
+	memset (lumpisheld, 0, numlumps);
+
+	compositeisheld = Z_Malloc (numtextures, PU_STATIC, 0);
+	heldcomposites = Z_Malloc (numtextures * sizeof(*heldcomposites),
+				   PU_STATIC, 0);
+	memset (compositeisheld, 0, numtextures);
+    }
 }
 
 
@@ -744,19 +1413,19 @@ int R_FlatNumForName (char* name)
 int	R_CheckTextureNumForName (char *name)
 {
     texture_t *texture;
-    int key;
+    uint64_t key;
 
     // "NoTexture" marker.
     if (name[0] == '-')		
 	return 0;
 		
-    key = W_LumpNameHash(name) % numtextures;
+    key = W_LumpNameKey(name);
 
-    texture=textures_hashtable[key]; 
+    texture=textures_hashtable[W_LumpKeyHash(key) % numtextures]; 
     
     while (texture != NULL)
     {
-	if (!strncasecmp (texture->name, name, 8) )
+	if (texture->key == key)
 	    return texture->index;
 
         texture = texture->next;
@@ -793,6 +1462,8 @@ int	R_TextureNumForName (char* name)
 // R_PrecacheLevel
 // Preloads all relevant graphics for the level.
 //
+static void R_FreePrecache (void);
+
 int		flatmemory;
 int		texturememory;
 int		spritememory;
@@ -812,6 +1483,9 @@ void R_PrecacheLevel (void)
     thinker_t*		th;
     spriteframe_t*	sf;
 
+    // Whatever R_PrecacheStep didn't get to is done here anyway.
+    R_FreePrecache ();
+
     if (demoplayback)
 	return;
     
@@ -910,3 +1584,238 @@ void R_PrecacheLevel (void)
 
 
 
+
+
+
+//
+// R_StartPrecache
+// Called as the intermission starts, with the level that comes
+//  after it.  That level isn't loaded yet, so its flats, textures
+//  and sprites are found from its raw lumps instead, and the list
+//  is worked through a little each tic by R_PrecacheStep while the
+//  intermission is up.  R_PrecacheLevel then finds most of the level
+//  already cached.
+// Entries are lump numbers, or -1-texnum for a texture composite.
+//
+#define PRECACHESTEP	(128*1024)	// bytes brought in each tic
+
+static int*		precachelist;
+static int		numprecache;
+static int		precachepos;
+
+static void R_AddPrecache (int item)
+{
+    precachelist[numprecache++] = item;
+
+    if (item >= 0)
+	W_PrefetchLumps (item, 1);
+}
+
+static void R_FreePrecache (void)
+{
+    if (precachelist)
+	Z_Free (precachelist);
+    precachelist = NULL;
+    numprecache = precachepos = 0;
+}
+
+void R_StartPrecache (int episode, int map)
+{
+    char		lumpname[9];
+    char		name[9];
+    char*		flatpresent;
+    char*		texturepresent;
+    char*		spritepresent;
+
+    int			i;
+    int			j;
+    int			k;
+    int			lumpnum;
+    int			count;
+    int			lump;
+    int			max;
+
+    mapsector_t*	ms;
+    mapsidedef_t*	msd;
+    mapthing_t*		mt;
+    texture_t*		texture;
+    spriteframe_t*	sf;
+
+    R_FreePrecache ();
+
+    if (demoplayback)
+	return;
+
+    P_MapLumpName (episode, map, lumpname);
+
+    lumpnum = W_CheckNumForName (lumpname);
+
+    if (lumpnum < 0 || lumpnum + ML_BLOCKMAP >= numlumps)
+	return;
+
+    flatpresent = Z_Malloc(numflats, PU_STATIC, NULL);
+    memset (flatpresent,0,numflats);
+    texturepresent = Z_Malloc(numtextures, PU_STATIC, NULL);
+    memset (texturepresent,0, numtextures);
+    spritepresent = Z_Malloc(numsprites, PU_STATIC, NULL);
+    memset (spritepresent,0, numsprites);
+
+    // Flats, by name as P_LoadSectors would look them up.
+    name[8] = 0;
+    count = W_LumpLength (lumpnum+ML_SECTORS) / sizeof(mapsector_t);
+    ms = W_CacheLumpNum (lumpnum+ML_SECTORS, PU_STATIC);
+    for (i=0 ; i<count ; i++, ms++)
+    {
+	memcpy (name, ms->floorpic, 8);
+	lump = W_CheckNumForName (name) - firstflat;
+	if (lump >= 0 && lump < numflats)
+	    flatpresent[lump] = 1;
+
+	memcpy (name, ms->ceilingpic, 8);
+	lump = W_CheckNumForName (name) - firstflat;
+	if (lump >= 0 && lump < numflats)
+	    flatpresent[lump] = 1;
+    }
+    W_ReleaseLumpNum (lumpnum+ML_SECTORS);
+
+    // Wall textures.
+    count = W_LumpLength (lumpnum+ML_SIDEDEFS) / sizeof(mapsidedef_t);
+    msd = W_CacheLumpNum (lumpnum+ML_SIDEDEFS, PU_STATIC);
+    for (i=0 ; i<count ; i++, msd++)
+    {
+	lump = R_CheckTextureNumForName (msd->toptexture);
+	if (lump > 0)
+	    texturepresent[lump] = 1;
+
+	lump = R_CheckTextureNumForName (msd->midtexture);
+	if (lump > 0)
+	    texturepresent[lump] = 1;
+
+	lump = R_CheckTextureNumForName (msd->bottomtexture);
+	if (lump > 0)
+	    texturepresent[lump] = 1;
+    }
+    W_ReleaseLumpNum (lumpnum+ML_SIDEDEFS);
+
+    // Sprites: the spawn state of everything placed in the level,
+    //  whatever the skill, and the player.
+    spritepresent[states[mobjinfo[MT_PLAYER].spawnstate].sprite] = 1;
+
+    count = W_LumpLength (lumpnum+ML_THINGS) / sizeof(mapthing_t);
+    mt = W_CacheLumpNum (lumpnum+ML_THINGS, PU_STATIC);
+    for (i=0 ; i<count ; i++, mt++)
+    {
+	for (j=0 ; j<NUMMOBJTYPES ; j++)
+	{
+	    if (SHORT(mt->type) == mobjinfo[j].doomednum)
+	    {
+		spritepresent[states[mobjinfo[j].spawnstate].sprite] = 1;
+		break;
+	    }
+	}
+    }
+    W_ReleaseLumpNum (lumpnum+ML_THINGS);
+
+    // Size the list, then fill it.
+    max = ML_BLOCKMAP;
+    for (i=0 ; i<numflats ; i++)
+	max += flatpresent[i];
+    for (i=0 ; i<numtextures ; i++)
+	if (texturepresent[i])
+	    max += textures[i]->patchcount + 1;
+    for (i=0 ; i<numsprites ; i++)
+	if (spritepresent[i])
+	    max += sprites[i].numframes * 8;
+
+    precachelist = Z_Malloc (max * sizeof(*precachelist), PU_STATIC, NULL);
+
+    // The level's own lumps go first, as P_SetupLevel wants them.
+    for (i=1 ; i<=ML_BLOCKMAP ; i++)
+	R_AddPrecache (lumpnum + i);
+
+    for (i=0 ; i<numflats ; i++)
+	if (flatpresent[i])
+	    R_AddPrecache (firstflat + i);
+
+    for (i=0 ; i<numtextures ; i++)
+    {
+	if (!texturepresent[i])
+	    continue;
+
+	texture = textures[i];
+	for (j=0 ; j<texture->patchcount ; j++)
+	    R_AddPrecache (texture->patches[j].patch);
+
+	// Composites are built from the patches just above.
+	if (!texturesbaked && texturecompositesize[i])
+	    R_AddPrecache (-1 - i);
+    }
+
+    for (i=0 ; i<numsprites ; i++)
+    {
+	if (!spritepresent[i])
+	    continue;
+
+	for (j=0 ; j<sprites[i].numframes ; j++)
+	{
+	    sf = &sprites[i].spriteframes[j];
+	    for (k=0 ; k<8 ; k++)
+		R_AddPrecache (firstspritelump + sf->lump[k]);
+	}
+    }
+
+    Z_Free (flatpresent);
+    Z_Free (texturepresent);
+    Z_Free (spritepresent);
+}
+
+
+
+//
+// R_PrecacheStep
+// Called every intermission tic.  Brings in the next part of the
+//  list from R_StartPrecache, so that no single tic stalls.
+//
+void R_PrecacheStep (void)
+{
+    int		bytes;
+    int		item;
+    boolean	composited;
+
+    if (!precachelist)
+	return;
+
+    bytes = 0;
+    composited = false;
+
+    while (precachepos < numprecache && bytes < PRECACHESTEP)
+    {
+	item = precachelist[precachepos++];
+
+	if (item < 0)
+	{
+	    item = -1 - item;
+	    if (!texturecomposite[item])
+	    {
+		R_GenerateComposite (item);
+		bytes += texturecompositesize[item];
+		composited = true;
+	    }
+	}
+	else if (lumpinfo[item].cache == NULL)
+	{
+	    // Only lumps that aren't cached already; caching one
+	    //  again would make it purgable under whoever has it
+	    //  locked, such as the intermission's own graphics.
+	    W_CacheLumpNum (item, PU_CACHE);
+	    bytes += lumpinfo[item].size;
+	}
+    }
+
+    // No frame is being drawn to release them.
+    if (composited)
+	R_ReleaseHeldLumps ();
+
+    if (precachepos == numprecache)
+	R_FreePrecache ();
+}
@@ -31,11 +31,26 @@ R_GetColumn
 ( int		tex,
   int		col );
 
+// Renderer access to cached lumps, safe with several render threads.
+void* R_CacheLumpNum (int lump, int tag);
+void R_ReleaseLumpNum (int lump);
+void R_ReleaseHeldLumps (void);
+
+
+// Save texture and sprite data to the cache directory and load
+//  it from there next time.
+extern boolean	r_bakedata;
+boolean R_UseBakedSpriteDefs (char** namelist);
+void R_SaveBakedData (char** namelist);
 
 // I/O, setting up the stuff.
 void R_InitData (void);
 void R_PrecacheLevel (void);
 
+// Precache the next level a tic at a time during the intermission.
+void R_StartPrecache (int episode, int map);
+void R_PrecacheStep (void);
+
 
 // Retrieval.
 // Floor/ceiling opaque texture tiles,
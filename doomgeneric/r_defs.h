@@ -48,6 +48,7 @@
 #define SIL_TOP			2
 #define SIL_BOTH		3
 
+// Initial number of drawsegs; more are added as needed.
 #define MAXDRAWSEGS		256
 
 
@@ -360,6 +361,9 @@ typedef struct vissprite_s
     // negative if flipped
     fixed_t		xiscale;	
 
+    // vertical step, always positive
+    fixed_t		yiscale;
+
     fixed_t		texturemid;
     int			patch;
 
@@ -420,8 +424,11 @@ typedef struct
 //
 // Now what is a visplane, anyway?
 // 
-typedef struct
+typedef struct visplane_s
 {
+  // next plane in the same R_FindPlane hash chain
+  struct visplane_s*	next;
+  
   fixed_t		height;
   int			picnum;
   int			lightlevel;
@@ -430,15 +437,15 @@ typedef struct
   
   // leave pads for [minx-1]/[maxx+1]
   
-  byte		pad1;
-  // Here lies the rub for all
-  //  dynamic resize/change of resolution.
-  byte		top[SCREENWIDTH];
-  byte		pad2;
-  byte		pad3;
+  unsigned short	pad1;
+  // Sized for the largest supported resolution,
+  //  so the screen size can change at runtime.
+  unsigned short	top[MAXWIDTH];
+  unsigned short	pad2;
+  unsigned short	pad3;
   // See above.
-  byte		bottom[SCREENWIDTH];
-  byte		pad4;
+  unsigned short	bottom[MAXWIDTH];
+  unsigned short	pad4;
 
 } visplane_t;
 
@@ -20,6 +20,7 @@
 
 
 
+#include <stdlib.h>
 
 #include "doomdef.h"
 #include "deh_main.h"
@@ -36,13 +37,19 @@
 // State.
 #include "doomstat.h"
 
+#include "st_stuff.h"
+
+// The span drawers have AVX2 versions that map eight pixels at a
+//  time. They're picked at runtime if the CPU supports them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+	&& !defined(__onramp__)
+#define R_SPANS_AVX2
+#include <immintrin.h>
+#endif
 
-// ?
-#define MAXWIDTH			1120
-#define MAXHEIGHT			832
 
 // status bar height at bottom of screen
-#define SBARHEIGHT		32
+#define SBARHEIGHT		(SCREENHEIGHT - SCREENY(ST_Y))
 
 //
 // All drawing to the view buffer is accomplished in this file.
@@ -63,6 +70,21 @@ int		viewwindowy;
 byte*		ylookup[MAXHEIGHT]; 
 int		columnofs[MAXWIDTH]; 
 
+// Distance between vertically and horizontally adjacent pixels.
+int		rowpitch;
+int		columnpitch;
+
+// The view can be drawn to a column-major buffer of its own, so the
+//  column drawers (walls, sprites, sky) walk straight down memory
+//  instead of jumping a screen width per pixel. Spans step a whole
+//  column per pixel, but R_MakeSpans draws vertically neighbouring
+//  spans one after another so they still share cache lines.
+// R_CopyViewBuffer copies it into the frame buffer after each view.
+// That copy costs about as much as the columns save at the sizes
+//  doom-cli renders, so it's off unless asked for.
+boolean		r_columnmajor = false;
+static byte	viewbuffer[MAXWIDTH*MAXHEIGHT];
+
 // Color tables for different players,
 //  translate a limited part to another
 //  (color ramps used for  suit colors).
@@ -79,18 +101,18 @@ static byte *background_buffer = NULL;
 // R_DrawColumn
 // Source is the top of the column to scale.
 //
-lighttable_t*		dc_colormap; 
-int			dc_x; 
-int			dc_yl; 
-int			dc_yh; 
-fixed_t			dc_iscale; 
-fixed_t			dc_texturemid;
+R_THREADLOCAL lighttable_t*		dc_colormap; 
+R_THREADLOCAL int			dc_x; 
+R_THREADLOCAL int			dc_yl; 
+R_THREADLOCAL int			dc_yh; 
+R_THREADLOCAL fixed_t			dc_iscale; 
+R_THREADLOCAL fixed_t			dc_texturemid;
 
 // first pixel in a column (possibly virtual) 
-byte*			dc_source;		
+R_THREADLOCAL byte*			dc_source;		
 
 // just for profiling 
-int			dccount;
+R_THREADLOCAL int			dccount;
 
 //
 // A column is a vertical slice/span from a wall texture that,
@@ -138,7 +160,7 @@ void R_DrawColumn (void)
 	//  using a lighting/special effects LUT.
 	*dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
 	
-	dest += SCREENWIDTH; 
+	dest += rowpitch; 
 	frac += fracstep;
 	
     } while (count--); 
@@ -243,8 +265,8 @@ void R_DrawColumnLow (void)
     {
 	// Hack. Does not work corretly.
 	*dest2 = *dest = dc_colormap[dc_source[(frac>>FRACBITS)&127]];
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
+	dest += rowpitch;
+	dest2 += rowpitch;
 	frac += fracstep; 
 
     } while (count--);
@@ -255,7 +277,7 @@ void R_DrawColumnLow (void)
 // Spectre/Invisibility.
 //
 #define FUZZTABLE		50 
-#define FUZZOFF	(SCREENWIDTH)
+#define FUZZOFF	1
 
 
 int	fuzzoffset[FUZZTABLE] =
@@ -269,7 +291,7 @@ int	fuzzoffset[FUZZTABLE] =
     FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF,FUZZOFF,-FUZZOFF,FUZZOFF 
 }; 
 
-int	fuzzpos = 0; 
+R_THREADLOCAL int	fuzzpos = 0; 
 
 
 //
@@ -301,6 +323,14 @@ void R_DrawFuzzColumn (void)
     if (count < 0) 
 	return; 
 
+    // Outside this thread's strip, just keep the fuzz sequence in step
+    //  with the thread that draws this column.
+    if (dc_x < r_stripx0 || dc_x >= r_stripx1)
+    {
+	fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
+	return;
+    }
+
 #ifdef RANGECHECK 
     if ((unsigned)dc_x >= SCREENWIDTH
 	|| dc_yl < 0 || dc_yh >= SCREENHEIGHT)
@@ -325,13 +355,13 @@ void R_DrawFuzzColumn (void)
 	//  a pixel that is either one column
 	//  left or right of the current one.
 	// Add index from colormap to index.
-	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]]]; 
+	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]*rowpitch]]; 
 
 	// Clamp table lookup index.
 	if (++fuzzpos == FUZZTABLE) 
 	    fuzzpos = 0;
 	
-	dest += SCREENWIDTH;
+	dest += rowpitch;
 
 	frac += fracstep; 
     } while (count--); 
@@ -362,6 +392,14 @@ void R_DrawFuzzColumnLow (void)
     if (count < 0) 
 	return; 
 
+    // Outside this thread's strip, just keep the fuzz sequence in step
+    //  with the thread that draws this column.
+    if (dc_x < r_stripx0 || dc_x >= r_stripx1)
+    {
+	fuzzpos = (fuzzpos + count + 1) % FUZZTABLE;
+	return;
+    }
+
     // low detail mode, need to multiply by 2
     
     x = dc_x << 1;
@@ -391,15 +429,15 @@ void R_DrawFuzzColumnLow (void)
 	//  a pixel that is either one column
 	//  left or right of the current one.
 	// Add index from colormap to index.
-	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]]]; 
-	*dest2 = colormaps[6*256+dest2[fuzzoffset[fuzzpos]]]; 
+	*dest = colormaps[6*256+dest[fuzzoffset[fuzzpos]*rowpitch]]; 
+	*dest2 = colormaps[6*256+dest2[fuzzoffset[fuzzpos]*rowpitch]]; 
 
 	// Clamp table lookup index.
 	if (++fuzzpos == FUZZTABLE) 
 	    fuzzpos = 0;
 	
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
+	dest += rowpitch;
+	dest2 += rowpitch;
 
 	frac += fracstep; 
     } while (count--); 
@@ -418,7 +456,7 @@ void R_DrawFuzzColumnLow (void)
 //  of the BaronOfHell, the HellKnight, uses
 //  identical sprites, kinda brightened up.
 //
-byte*	dc_translation;
+R_THREADLOCAL byte*	dc_translation;
 byte*	translationtables;
 
 void R_DrawTranslatedColumn (void) 
@@ -459,7 +497,7 @@ void R_DrawTranslatedColumn (void)
 	// Thus the "green" ramp of the player 0 sprite
 	//  is mapped to gray, red, black/indigo. 
 	*dest = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
-	dest += SCREENWIDTH;
+	dest += rowpitch;
 	
 	frac += fracstep; 
     } while (count--); 
@@ -510,8 +548,8 @@ void R_DrawTranslatedColumnLow (void)
 	//  is mapped to gray, red, black/indigo. 
 	*dest = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
 	*dest2 = dc_colormap[dc_translation[dc_source[frac>>FRACBITS]]];
-	dest += SCREENWIDTH;
-	dest2 += SCREENWIDTH;
+	dest += rowpitch;
+	dest2 += rowpitch;
 	
 	frac += fracstep; 
     } while (count--); 
@@ -567,22 +605,22 @@ void R_InitTranslationTables (void)
 // In consequence, flats are not stored by column (like walls),
 //  and the inner loop has to step in texture space u and v.
 //
-int			ds_y; 
-int			ds_x1; 
-int			ds_x2;
+R_THREADLOCAL int			ds_y; 
+R_THREADLOCAL int			ds_x1; 
+R_THREADLOCAL int			ds_x2;
 
-lighttable_t*		ds_colormap; 
+R_THREADLOCAL lighttable_t*		ds_colormap; 
 
-fixed_t			ds_xfrac; 
-fixed_t			ds_yfrac; 
-fixed_t			ds_xstep; 
-fixed_t			ds_ystep;
+R_THREADLOCAL fixed_t			ds_xfrac; 
+R_THREADLOCAL fixed_t			ds_yfrac; 
+R_THREADLOCAL fixed_t			ds_xstep; 
+R_THREADLOCAL fixed_t			ds_ystep;
 
 // start of a 64*64 tile image 
-byte*			ds_source;	
+R_THREADLOCAL byte*			ds_source;	
 
 // just for profiling
-int			dscount;
+R_THREADLOCAL int			dscount;
 
 
 //
@@ -631,7 +669,8 @@ void R_DrawSpan (void)
 
 	// Lookup pixel from flat texture tile,
 	//  re-index using light/colormap.
-	*dest++ = ds_colormap[ds_source[spot]];
+	*dest = ds_colormap[ds_source[spot]];
+	dest += columnpitch;
 
         position += step;
 
@@ -758,14 +797,540 @@ void R_DrawSpanLow (void)
 
 	// Lowres/blocky mode does it twice,
 	//  while scale is adjusted appropriately.
-	*dest++ = ds_colormap[ds_source[spot]];
-	*dest++ = ds_colormap[ds_source[spot]];
+	dest[0] = ds_colormap[ds_source[spot]];
+	dest[columnpitch] = ds_colormap[ds_source[spot]];
+	dest += columnpitch*2;
 
 	position += step;
 
     } while (count--);
 }
 
+#ifdef R_SPANS_AVX2
+
+//
+// R_MapSpan8
+// Maps eight pixels of a span starting at the packed position
+//  pos (one per 32-bit lane) to colors, in the low 8 bytes.
+// Gathers read the aligned dword holding each byte we want and
+//  shift it out. The tables needn't be aligned: sourceofs and
+//  colormapofs are how far each starts into its first dword.
+//  An aligned dword never crosses a page, so reading the whole
+//  of it can't fault past the end of a flat or colormap.
+//
+__attribute__((target("avx2")))
+static inline __m128i
+R_MapSpan8
+( __m256i	pos,
+  const int*	source,
+  __m256i	sourceofs,
+  const int*	colormap,
+  __m256i	colormapofs )
+{
+    const __m256i	ymask = _mm256_set1_epi32(0x0fc0);
+    const __m256i	bytemask = _mm256_set1_epi32(0xff);
+    const __m256i	three = _mm256_set1_epi32(3);
+    const __m256i	pack = _mm256_setr_epi8(
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i		spot;
+    __m256i		pixel;
+
+    spot = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(pos, 4), ymask),
+			   _mm256_srli_epi32(pos, 26));
+    spot = _mm256_add_epi32(spot, sourceofs);
+
+    pixel = _mm256_i32gather_epi32(source, _mm256_srli_epi32(spot, 2), 4);
+    pixel = _mm256_srlv_epi32(pixel,
+			      _mm256_slli_epi32(_mm256_and_si256(spot, three), 3));
+    pixel = _mm256_and_si256(pixel, bytemask);
+
+    spot = _mm256_add_epi32(pixel, colormapofs);
+    pixel = _mm256_i32gather_epi32(colormap, _mm256_srli_epi32(spot, 2), 4);
+    pixel = _mm256_srlv_epi32(pixel,
+			      _mm256_slli_epi32(_mm256_and_si256(spot, three), 3));
+
+    pixel = _mm256_shuffle_epi8(pixel, pack);
+    return _mm_unpacklo_epi32(_mm256_castsi256_si128(pixel),
+			      _mm256_extracti128_si256(pixel, 1));
+}
+
+//
+// R_DrawSpanAVX2
+// Same as R_DrawSpan, eight pixels at a time.
+//
+__attribute__((target("avx2")))
+static void R_DrawSpanAVX2 (void)
+{
+    unsigned int position, step;
+    unsigned int xtemp, ytemp;
+    byte *dest;
+    int count;
+    int spot;
+    int i;
+    __m256i pos, step8;
+    __m256i sourceofs, colormapofs;
+    const int* source;
+    const int* colormap;
+    __m128i pixels;
+    byte out[16];
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+    count = ds_x2 - ds_x1 + 1;
+
+    if (count >= 8)
+    {
+	// Flats mapped straight out of the WAD are rarely aligned.
+	source = (const int*) ((uintptr_t) ds_source & ~(uintptr_t) 3);
+	sourceofs = _mm256_set1_epi32((uintptr_t) ds_source & 3);
+	colormap = (const int*) ((uintptr_t) ds_colormap & ~(uintptr_t) 3);
+	colormapofs = _mm256_set1_epi32((uintptr_t) ds_colormap & 3);
+
+	pos = _mm256_add_epi32(_mm256_set1_epi32(position),
+			       _mm256_mullo_epi32(_mm256_set1_epi32(step),
+						  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	step8 = _mm256_set1_epi32(step * 8);
+
+	do
+	{
+	    pixels = R_MapSpan8 (pos, source, sourceofs,
+				  colormap, colormapofs);
+
+	    if (columnpitch == 1)
+	    {
+		_mm_storel_epi64((__m128i*) dest, pixels);
+		dest += 8;
+	    }
+	    else
+	    {
+		_mm_storeu_si128((__m128i*) out, pixels);
+		for (i=0 ; i<8 ; i++)
+		{
+		    *dest = out[i];
+		    dest += columnpitch;
+		}
+	    }
+
+	    pos = _mm256_add_epi32(pos, step8);
+	    position += step * 8;
+	    count -= 8;
+	} while (count >= 8);
+    }
+
+    while (count-- > 0)
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	*dest = ds_colormap[ds_source[spot]];
+	dest += columnpitch;
+
+        position += step;
+    }
+}
+
+//
+// R_DrawSpanLowAVX2
+// Same as R_DrawSpanLow, eight pixels (sixteen wide) at a time.
+//
+__attribute__((target("avx2")))
+static void R_DrawSpanLowAVX2 (void)
+{
+    unsigned int position, step;
+    unsigned int xtemp, ytemp;
+    byte *dest;
+    int count;
+    int spot;
+    int i;
+    __m256i pos, step8;
+    __m256i sourceofs, colormapofs;
+    const int* source;
+    const int* colormap;
+    __m128i pixels;
+    byte out[16];
+
+    position = ((ds_xfrac << 10) & 0xffff0000)
+             | ((ds_yfrac >> 6)  & 0x0000ffff);
+    step = ((ds_xstep << 10) & 0xffff0000)
+         | ((ds_ystep >> 6)  & 0x0000ffff);
+
+    count = ds_x2 - ds_x1 + 1;
+
+    // Blocky mode, need to multiply by 2.
+    ds_x1 <<= 1;
+    ds_x2 <<= 1;
+
+    dest = ylookup[ds_y] + columnofs[ds_x1];
+
+    if (count >= 8)
+    {
+	// Flats mapped straight out of the WAD are rarely aligned.
+	source = (const int*) ((uintptr_t) ds_source & ~(uintptr_t) 3);
+	sourceofs = _mm256_set1_epi32((uintptr_t) ds_source & 3);
+	colormap = (const int*) ((uintptr_t) ds_colormap & ~(uintptr_t) 3);
+	colormapofs = _mm256_set1_epi32((uintptr_t) ds_colormap & 3);
+
+	pos = _mm256_add_epi32(_mm256_set1_epi32(position),
+			       _mm256_mullo_epi32(_mm256_set1_epi32(step),
+						  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	step8 = _mm256_set1_epi32(step * 8);
+
+	do
+	{
+	    // each pixel is drawn twice
+	    pixels = R_MapSpan8 (pos, source, sourceofs,
+				  colormap, colormapofs);
+	    pixels = _mm_unpacklo_epi8(pixels, pixels);
+
+	    if (columnpitch == 1)
+	    {
+		_mm_storeu_si128((__m128i*) dest, pixels);
+		dest += 16;
+	    }
+	    else
+	    {
+		_mm_storeu_si128((__m128i*) out, pixels);
+		for (i=0 ; i<16 ; i++)
+		{
+		    *dest = out[i];
+		    dest += columnpitch;
+		}
+	    }
+
+	    pos = _mm256_add_epi32(pos, step8);
+	    position += step * 8;
+	    count -= 8;
+	} while (count >= 8);
+    }
+
+    while (count-- > 0)
+    {
+        ytemp = (position >> 4) & 0x0fc0;
+        xtemp = (position >> 26);
+        spot = xtemp | ytemp;
+
+	dest[0] = ds_colormap[ds_source[spot]];
+	dest[columnpitch] = ds_colormap[ds_source[spot]];
+	dest += columnpitch*2;
+
+	position += step;
+    }
+}
+
+#endif // R_SPANS_AVX2
+
+
+//
+// R_InitSpanFuncs
+// Picks the fastest span drawers this CPU can run.
+//
+void (*drawspanfunc) (void) = R_DrawSpan;
+void (*drawspanlowfunc) (void) = R_DrawSpanLow;
+
+void R_InitSpanFuncs (void)
+{
+    drawspanfunc = R_DrawSpan;
+    drawspanlowfunc = R_DrawSpanLow;
+
+#ifdef R_SPANS_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+	drawspanfunc = R_DrawSpanAVX2;
+	drawspanlowfunc = R_DrawSpanLowAVX2;
+    }
+#endif
+}
+
+//
+// R_ClipSpan
+// Trims the span to the columns of this thread's strip.
+// The start position is stepped in the same packed form
+//  the span drawers use, so the pixels that are left come
+//  out exactly as they would if the whole span was drawn.
+// Returns false if none of the span is left.
+//
+boolean R_ClipSpan (void)
+{
+    unsigned int position, step;
+
+    if (ds_x2 >= r_stripx1)
+	ds_x2 = r_stripx1 - 1;
+
+    if (ds_x1 < r_stripx0)
+    {
+	position = ((ds_xfrac << 10) & 0xffff0000)
+	         | ((ds_yfrac >> 6)  & 0x0000ffff);
+	step = ((ds_xstep << 10) & 0xffff0000)
+	     | ((ds_ystep >> 6)  & 0x0000ffff);
+
+	position += step * (unsigned int) (r_stripx0 - ds_x1);
+
+	ds_xfrac = (position >> 16) << 6;
+	ds_yfrac = (position & 0xffff) << 6;
+	ds_x1 = r_stripx0;
+    }
+
+    return ds_x1 <= ds_x2;
+}
+
+//
+// Deferred drawing.
+// The drawers below stand in for the real ones and only record
+//  a command with the dc_*/ds_* state. The commands are drawn in
+//  batches by R_FlushDrawCommands: walls, sky and flats once the
+//  planes are done, then the masked things at the end of the frame.
+// Each render thread keeps lists of its own.
+//
+boolean		r_deferred = false;
+
+typedef struct
+{
+    void		(*func) (void);
+    byte*		source;
+    lighttable_t*	colormap;
+    byte*		translation;
+    int			x;
+    int			yl;
+    int			yh;
+    fixed_t		iscale;
+    fixed_t		texturemid;
+} colcmd_t;
+
+typedef struct
+{
+    byte*		source;
+    lighttable_t*	colormap;
+    int			y;
+    int			x1;
+    int			x2;
+    fixed_t		xfrac;
+    fixed_t		yfrac;
+    fixed_t		xstep;
+    fixed_t		ystep;
+} spancmd_t;
+
+// the drawers for the detail level, set by R_DeferDrawers
+static void		(*drawcolfunc) (void);
+static void		(*drawfuzzcolfunc) (void);
+static void		(*drawtranscolfunc) (void);
+static void		(*drawdeferspanfunc) (void);
+
+static R_THREADLOCAL colcmd_t*	colcmds;
+static R_THREADLOCAL int	numcolcmds;
+static R_THREADLOCAL int	maxcolcmds;
+
+static R_THREADLOCAL spancmd_t*	spancmds;
+static R_THREADLOCAL int	numspancmds;
+static R_THREADLOCAL int	maxspancmds;
+
+// scratch for sorting, as big as the larger list
+static R_THREADLOCAL void*	sortcmds;
+static R_THREADLOCAL size_t	sortcmdsize;
+
+//
+// R_GrowDrawCommands
+// Makes room for twice as many commands in the list.
+//
+static void* R_GrowDrawCommands (void* cmds, int* max, size_t size)
+{
+    int		newmax = *max ? *max*2 : 1024;
+
+    cmds = realloc (cmds, newmax * size);
+    if (cmds == NULL)
+	I_Error ("R_GrowDrawCommands: out of memory (%i commands)", newmax);
+    *max = newmax;
+
+    return cmds;
+}
+
+static void R_QueueColumnFunc (void (*func) (void))
+{
+    colcmd_t*	cmd;
+
+    if (numcolcmds == maxcolcmds)
+	colcmds = R_GrowDrawCommands (colcmds, &maxcolcmds, sizeof(*colcmds));
+
+    cmd = &colcmds[numcolcmds++];
+    cmd->func = func;
+    cmd->source = dc_source;
+    cmd->colormap = dc_colormap;
+    cmd->translation = dc_translation;
+    cmd->x = dc_x;
+    cmd->yl = dc_yl;
+    cmd->yh = dc_yh;
+    cmd->iscale = dc_iscale;
+    cmd->texturemid = dc_texturemid;
+}
+
+static void R_QueueColumn (void)
+{
+    R_QueueColumnFunc (drawcolfunc);
+}
+
+static void R_QueueFuzzColumn (void)
+{
+    R_QueueColumnFunc (drawfuzzcolfunc);
+}
+
+static void R_QueueTranslatedColumn (void)
+{
+    R_QueueColumnFunc (drawtranscolfunc);
+}
+
+static void R_QueueSpan (void)
+{
+    spancmd_t*	cmd;
+
+    if (numspancmds == maxspancmds)
+	spancmds = R_GrowDrawCommands (spancmds, &maxspancmds, sizeof(*spancmds));
+
+    cmd = &spancmds[numspancmds++];
+    cmd->source = ds_source;
+    cmd->colormap = ds_colormap;
+    cmd->y = ds_y;
+    cmd->x1 = ds_x1;
+    cmd->x2 = ds_x2;
+    cmd->xfrac = ds_xfrac;
+    cmd->yfrac = ds_yfrac;
+    cmd->xstep = ds_xstep;
+    cmd->ystep = ds_ystep;
+}
+
+//
+// R_DeferDrawers
+// Called once the drawers for the detail level are picked.
+// Puts them aside and swaps in the ones that record commands.
+//
+void R_DeferDrawers (void)
+{
+    drawcolfunc = basecolfunc;
+    drawfuzzcolfunc = fuzzcolfunc;
+    drawtranscolfunc = transcolfunc;
+    drawdeferspanfunc = spanfunc;
+
+    colfunc = basecolfunc = R_QueueColumn;
+    fuzzcolfunc = R_QueueFuzzColumn;
+    transcolfunc = R_QueueTranslatedColumn;
+    spanfunc = R_QueueSpan;
+}
+
+static void* R_SortScratch (int count, size_t size)
+{
+    if (sortcmdsize < count * size)
+    {
+	sortcmdsize = count * size;
+	sortcmds = realloc (sortcmds, sortcmdsize);
+	if (sortcmds == NULL)
+	    I_Error ("R_SortScratch: out of memory (%i commands)", count);
+    }
+    return sortcmds;
+}
+
+//
+// R_SortColumnCommands
+// Counting sort by column, keeping the order within each
+//  column, so the frame buffer is walked left to right.
+//
+static colcmd_t* R_SortColumnCommands (void)
+{
+    int		start[MAXWIDTH+1];
+    colcmd_t*	sorted;
+    int		i;
+
+    memset (start, 0, sizeof(start));
+    for (i=0 ; i<numcolcmds ; i++)
+	start[colcmds[i].x+1]++;
+    for (i=0 ; i<viewwidth ; i++)
+	start[i+1] += start[i];
+
+    sorted = R_SortScratch (numcolcmds, sizeof(*colcmds));
+    for (i=0 ; i<numcolcmds ; i++)
+	sorted[start[colcmds[i].x]++] = colcmds[i];
+
+    return sorted;
+}
+
+//
+// R_SortSpanCommands
+// Counting sort by row, keeping the order within each row.
+//
+static spancmd_t* R_SortSpanCommands (void)
+{
+    int		start[MAXHEIGHT+1];
+    spancmd_t*	sorted;
+    int		i;
+
+    memset (start, 0, sizeof(start));
+    for (i=0 ; i<numspancmds ; i++)
+	start[spancmds[i].y+1]++;
+    for (i=0 ; i<viewheight ; i++)
+	start[i+1] += start[i];
+
+    sorted = R_SortScratch (numspancmds, sizeof(*spancmds));
+    for (i=0 ; i<numspancmds ; i++)
+	sorted[start[spancmds[i].y]++] = spancmds[i];
+
+    return sorted;
+}
+
+//
+// R_FlushDrawCommands
+// Draws everything recorded so far on this thread and empties
+//  the lists. Walls, sky and flats never cover each other, so
+//  they can be sorted to suit the frame buffer. Masked things
+//  overlap and the fuzz reads what's under it, so those must
+//  be drawn in the order they came.
+//
+void R_FlushDrawCommands (boolean sorted)
+{
+    spancmd_t*	span;
+    colcmd_t*	col;
+    int		i;
+
+    if (numspancmds)
+    {
+	span = sorted ? R_SortSpanCommands () : spancmds;
+	for (i=0 ; i<numspancmds ; i++, span++)
+	{
+	    ds_source = span->source;
+	    ds_colormap = span->colormap;
+	    ds_y = span->y;
+	    ds_x1 = span->x1;
+	    ds_x2 = span->x2;
+	    ds_xfrac = span->xfrac;
+	    ds_yfrac = span->yfrac;
+	    ds_xstep = span->xstep;
+	    ds_ystep = span->ystep;
+	    drawdeferspanfunc ();
+	}
+	numspancmds = 0;
+    }
+
+    if (numcolcmds)
+    {
+	col = sorted ? R_SortColumnCommands () : colcmds;
+	for (i=0 ; i<numcolcmds ; i++, col++)
+	{
+	    dc_source = col->source;
+	    dc_colormap = col->colormap;
+	    dc_translation = col->translation;
+	    dc_x = col->x;
+	    dc_yl = col->yl;
+	    dc_yh = col->yh;
+	    dc_iscale = col->iscale;
+	    dc_texturemid = col->texturemid;
+	    col->func ();
+	}
+	numcolcmds = 0;
+    }
+}
+
 //
 // R_InitBuffer 
 // Creats lookup tables that avoid
@@ -785,20 +1350,125 @@ R_InitBuffer
     //  with border and/or status bar.
     viewwindowx = (SCREENWIDTH-width) >> 1; 
 
-    // Column offset. For windows.
-    for (i=0 ; i<width ; i++) 
-	columnofs[i] = viewwindowx + i;
-
     // Samw with base row offset.
     if (width == SCREENWIDTH) 
 	viewwindowy = 0; 
     else 
 	viewwindowy = (SCREENHEIGHT-SBARHEIGHT-height) >> 1; 
 
+    if (r_columnmajor)
+    {
+	// Columns of the view buffer are height pixels tall.
+	for (i=0 ; i<width ; i++) 
+	    columnofs[i] = i*height;
+	for (i=0 ; i<height ; i++) 
+	    ylookup[i] = viewbuffer + i; 
+
+	rowpitch = 1;
+	columnpitch = height;
+	return;
+    }
+
+    // Column offset. For windows.
+    for (i=0 ; i<width ; i++) 
+	columnofs[i] = viewwindowx + i;
+
     // Preclaculate all row offsets.
     for (i=0 ; i<height ; i++) 
 	ylookup[i] = I_VideoBuffer + (i+viewwindowy)*SCREENWIDTH; 
+
+    rowpitch = SCREENWIDTH;
+    columnpitch = 1;
 } 
+
+
+//
+// R_CopyViewBuffer
+// Copies this thread's strip of the column-major view buffer
+//  into the frame buffer. Most of it is transposed in 8x8
+//  blocks held in 64-bit words, which is several times faster
+//  than going a pixel at a time. Like the WAD code, this
+//  assumes a little-endian host.
+//
+#define VIEWBLOCKSWAP(a, b, shift, mask) \
+    { \
+	uint64_t t = (((a) >> (shift)) ^ (b)) & (mask); \
+	(b) ^= t; \
+	(a) ^= t << (shift); \
+    }
+
+static void R_CopyViewBlock (byte* source, byte* dest)
+{
+    uint64_t	r[8];
+    int		i;
+
+    for (i=0 ; i<8 ; i++)
+	memcpy (&r[i], source + i*viewheight, 8);
+
+    VIEWBLOCKSWAP (r[0], r[1], 8, 0x00ff00ff00ff00ffull);
+    VIEWBLOCKSWAP (r[2], r[3], 8, 0x00ff00ff00ff00ffull);
+    VIEWBLOCKSWAP (r[4], r[5], 8, 0x00ff00ff00ff00ffull);
+    VIEWBLOCKSWAP (r[6], r[7], 8, 0x00ff00ff00ff00ffull);
+    VIEWBLOCKSWAP (r[0], r[2], 16, 0x0000ffff0000ffffull);
+    VIEWBLOCKSWAP (r[1], r[3], 16, 0x0000ffff0000ffffull);
+    VIEWBLOCKSWAP (r[4], r[6], 16, 0x0000ffff0000ffffull);
+    VIEWBLOCKSWAP (r[5], r[7], 16, 0x0000ffff0000ffffull);
+    VIEWBLOCKSWAP (r[0], r[4], 32, 0x00000000ffffffffull);
+    VIEWBLOCKSWAP (r[1], r[5], 32, 0x00000000ffffffffull);
+    VIEWBLOCKSWAP (r[2], r[6], 32, 0x00000000ffffffffull);
+    VIEWBLOCKSWAP (r[3], r[7], 32, 0x00000000ffffffffull);
+
+    for (i=0 ; i<8 ; i++)
+	memcpy (dest + i*SCREENWIDTH, &r[i], 8);
+}
+
+static void R_CopyViewPixels (int x1, int x2, int y1, int y2)
+{
+    int		x;
+    int		y;
+    byte*	source;
+    byte*	dest;
+
+    for (x=x1 ; x<x2 ; x++)
+    {
+	source = viewbuffer + columnofs[x] + y1;
+	dest = I_VideoBuffer + (y1+viewwindowy)*SCREENWIDTH + viewwindowx + x;
+
+	for (y=y1 ; y<y2 ; y++)
+	{
+	    *dest = *source++;
+	    dest += SCREENWIDTH;
+	}
+    }
+}
+
+void R_CopyViewBuffer (void)
+{
+    int		x1;
+    int		x2;
+    int		xblocks;
+    int		yblocks;
+    int		x;
+    int		y;
+
+    x1 = r_stripx0 << detailshift;
+    x2 = (r_stripx1 < viewwidth ? r_stripx1 : viewwidth) << detailshift;
+    if (x1 >= x2)
+	return;
+
+    xblocks = x1 + ((x2 - x1) & ~7);
+    yblocks = viewheight & ~7;
+
+    for (x=x1 ; x<xblocks ; x+=8)
+	for (y=0 ; y<yblocks ; y+=8)
+	    R_CopyViewBlock (viewbuffer + columnofs[x] + y,
+			     I_VideoBuffer + (y+viewwindowy)*SCREENWIDTH
+			     + viewwindowx + x);
+
+    // the edges that don't fill a block
+    R_CopyViewPixels (x1, xblocks, yblocks, viewheight);
+    R_CopyViewPixels (xblocks, x2, 0, viewheight);
+}
  
  
 
@@ -815,6 +1485,8 @@ void R_FillBackScreen (void)
     byte*	dest; 
     int		x;
     int		y; 
+    int		x0, y0;
+    int		width, height;
     patch_t*	patch;
 
     // DOOM border patch.
@@ -854,58 +1526,62 @@ void R_FillBackScreen (void)
     
     src = W_CacheLumpName(name, PU_CACHE); 
     dest = background_buffer;
-	 
+
+    // The flat is tiled in the original 320x200 coordinates so it
+    // scales with the rest of the screen.
     for (y=0 ; y<SCREENHEIGHT-SBARHEIGHT ; y++) 
     { 
-	for (x=0 ; x<SCREENWIDTH/64 ; x++) 
-	{ 
-	    memcpy (dest, src+((y&63)<<6), 64); 
-	    dest += 64; 
-	} 
-
-	if (SCREENWIDTH&63) 
-	{ 
-	    memcpy (dest, src+((y&63)<<6), SCREENWIDTH&63); 
-	    dest += (SCREENWIDTH&63); 
-	} 
+	byte *row = src + (((y * ORIGHEIGHT / SCREENHEIGHT) & 63) << 6);
+
+	for (x=0 ; x<SCREENWIDTH ; x++) 
+	    *dest++ = row[(x * ORIGWIDTH / SCREENWIDTH) & 63];
     } 
      
     // Draw screen and bezel; this is done to a separate screen buffer.
+    // Patches are positioned in original coordinates, so find the
+    // smallest original rectangle that covers the view window.
+
+    x0 = viewwindowx * ORIGWIDTH / SCREENWIDTH;
+    y0 = viewwindowy * ORIGHEIGHT / SCREENHEIGHT;
+    width = ((viewwindowx + scaledviewwidth) * ORIGWIDTH + SCREENWIDTH - 1)
+          / SCREENWIDTH - x0;
+    height = ((viewwindowy + viewheight) * ORIGHEIGHT + SCREENHEIGHT - 1)
+           / SCREENHEIGHT - y0;
 
     V_UseBuffer(background_buffer);
 
     patch = W_CacheLumpName(DEH_String("brdr_t"),PU_CACHE);
 
-    for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch(viewwindowx+x, viewwindowy-8, patch);
+    for (x=0 ; x<width ; x+=8)
+	V_DrawPatch(x0+x, y0-8, patch);
     patch = W_CacheLumpName(DEH_String("brdr_b"),PU_CACHE);
 
-    for (x=0 ; x<scaledviewwidth ; x+=8)
-	V_DrawPatch(viewwindowx+x, viewwindowy+viewheight, patch);
+    for (x=0 ; x<width ; x+=8)
+	V_DrawPatch(x0+x, y0+height, patch);
     patch = W_CacheLumpName(DEH_String("brdr_l"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
-	V_DrawPatch(viewwindowx-8, viewwindowy+y, patch);
+    for (y=0 ; y<height ; y+=8)
+	V_DrawPatch(x0-8, y0+y, patch);
     patch = W_CacheLumpName(DEH_String("brdr_r"),PU_CACHE);
 
-    for (y=0 ; y<viewheight ; y+=8)
-	V_DrawPatch(viewwindowx+scaledviewwidth, viewwindowy+y, patch);
+    for (y=0 ; y<height ; y+=8)
+	V_DrawPatch(x0+width, y0+y, patch);
 
     // Draw beveled edge. 
-    V_DrawPatch(viewwindowx-8,
-                viewwindowy-8,
+    V_DrawPatch(x0-8,
+                y0-8,
                 W_CacheLumpName(DEH_String("brdr_tl"),PU_CACHE));
     
-    V_DrawPatch(viewwindowx+scaledviewwidth,
-                viewwindowy-8,
+    V_DrawPatch(x0+width,
+                y0-8,
                 W_CacheLumpName(DEH_String("brdr_tr"),PU_CACHE));
     
-    V_DrawPatch(viewwindowx-8,
-                viewwindowy+viewheight,
+    V_DrawPatch(x0-8,
+                y0+height,
                 W_CacheLumpName(DEH_String("brdr_bl"),PU_CACHE));
     
-    V_DrawPatch(viewwindowx+scaledviewwidth,
-                viewwindowy+viewheight,
+    V_DrawPatch(x0+width,
+                y0+height,
                 W_CacheLumpName(DEH_String("brdr_br"),PU_CACHE));
 
     V_RestoreBuffer();
@@ -23,15 +23,15 @@
 
 
 
-extern lighttable_t*	dc_colormap;
-extern int		dc_x;
-extern int		dc_yl;
-extern int		dc_yh;
-extern fixed_t		dc_iscale;
-extern fixed_t		dc_texturemid;
+extern R_THREADLOCAL lighttable_t*	dc_colormap;
+extern R_THREADLOCAL int		dc_x;
+extern R_THREADLOCAL int		dc_yl;
+extern R_THREADLOCAL int		dc_yh;
+extern R_THREADLOCAL fixed_t		dc_iscale;
+extern R_THREADLOCAL fixed_t		dc_texturemid;
 
 // first pixel in a column
-extern byte*		dc_source;		
+extern R_THREADLOCAL byte*		dc_source;		
 
 
 // The span blitting interface.
@@ -55,22 +55,24 @@ R_VideoErase
 ( unsigned	ofs,
   int		count );
 
-extern int		ds_y;
-extern int		ds_x1;
-extern int		ds_x2;
+extern R_THREADLOCAL int		ds_y;
+extern R_THREADLOCAL int		ds_x1;
+extern R_THREADLOCAL int		ds_x2;
 
-extern lighttable_t*	ds_colormap;
+extern R_THREADLOCAL lighttable_t*	ds_colormap;
 
-extern fixed_t		ds_xfrac;
-extern fixed_t		ds_yfrac;
-extern fixed_t		ds_xstep;
-extern fixed_t		ds_ystep;
+extern R_THREADLOCAL fixed_t		ds_xfrac;
+extern R_THREADLOCAL fixed_t		ds_yfrac;
+extern R_THREADLOCAL fixed_t		ds_xstep;
+extern R_THREADLOCAL fixed_t		ds_ystep;
 
 // start of a 64*64 tile image
-extern byte*		ds_source;		
+extern R_THREADLOCAL byte*		ds_source;		
+
+extern R_THREADLOCAL int	fuzzpos;
 
 extern byte*		translationtables;
-extern byte*		dc_translation;
+extern R_THREADLOCAL byte*		dc_translation;
 
 
 // Span blitting for rows, floor/ceiling.
@@ -80,12 +82,33 @@ void 	R_DrawSpan (void);
 // Low resolution mode, 160x200?
 void 	R_DrawSpanLow (void);
 
+// The span drawers to use on this CPU, set by R_InitSpanFuncs.
+extern void	(*drawspanfunc) (void);
+extern void	(*drawspanlowfunc) (void);
+void	R_InitSpanFuncs (void);
+
+// Trims the span to this thread's strip.
+boolean	R_ClipSpan (void);
+
+
+// Draw the view column-major and copy it out after (see r_draw.c.)
+extern boolean		r_columnmajor;
 
 void
 R_InitBuffer
 ( int		width,
   int		height );
 
+// Copies this thread's strip of the view to the frame buffer.
+void	R_CopyViewBuffer (void);
+
+
+// Record columns and spans and draw them in batches (see r_draw.c.)
+extern boolean		r_deferred;
+
+void	R_DeferDrawers (void);
+void	R_FlushDrawCommands (boolean sorted);
+
 
 // Initialize color translation tables,
 //  for player rendering etc.
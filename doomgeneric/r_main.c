@@ -28,18 +28,24 @@
 
 #include "doomdef.h"
 #include "d_loop.h"
+#include "i_system.h"
 
 #include "m_bbox.h"
 #include "m_menu.h"
+#include "m_profile.h"
 
 #include "r_local.h"
 #include "r_sky.h"
 
+#ifdef R_THREADS
+#include <pthread.h>
+#endif
+
 
 
 
 
-// Fineangles in the SCREENWIDTH wide window.
+// Fineangles in the view window.
 #define FIELDOFVIEW		2048	
 
 
@@ -51,7 +57,7 @@ int			validcount = 1;
 
 
 lighttable_t*		fixedcolormap;
-extern lighttable_t**	walllights;
+extern R_THREADLOCAL lighttable_t**	walllights;
 
 int			centerx;
 int			centery;
@@ -60,10 +66,15 @@ fixed_t			centerxfrac;
 fixed_t			centeryfrac;
 fixed_t			projection;
 
+// Vertical projection. The original screen has non-square pixels that are
+// displayed at 4:3, so this is scaled from projection by the screen's pixel
+// aspect ratio relative to 320x200. It equals projection at 320x200.
+fixed_t			projectiony;
+
 // just for profiling purposes
 int			framecount;	
 
-int			sscount;
+R_THREADLOCAL int			sscount;
 int			linecount;
 int			loopcount;
 
@@ -95,7 +106,7 @@ int			viewangletox[FINEANGLES/2];
 // The xtoviewangleangle[] table maps a screen pixel
 // to the lowest viewangle that maps back to x ranges
 // from clipangle to -clipangle.
-angle_t			xtoviewangle[SCREENWIDTH+1];
+angle_t			xtoviewangle[MAXWIDTH+1];
 
 lighttable_t*		scalelight[LIGHTLEVELS][MAXLIGHTSCALE];
 lighttable_t*		scalelightfixed[MAXLIGHTSCALE];
@@ -104,9 +115,15 @@ lighttable_t*		zlight[LIGHTLEVELS][MAXLIGHTZ];
 // bumped light from gun blasts
 int			extralight;			
 
+int			r_numthreads = 1;
+
+// the whole view unless rendering on several threads
+R_THREADLOCAL int	r_stripx0 = 0;
+R_THREADLOCAL int	r_stripx1 = MAXWIDTH;
+
 
 
-void (*colfunc) (void);
+R_THREADLOCAL void (*colfunc) (void);
 void (*basecolfunc) (void);
 void (*fuzzcolfunc) (void);
 void (*transcolfunc) (void);
@@ -479,7 +496,7 @@ fixed_t R_ScaleFromGlobalAngle (angle_t visangle)
     // both sines are allways positive
     sinea = finesine[anglea>>ANGLETOFINESHIFT];	
     sineb = finesine[angleb>>ANGLETOFINESHIFT];
-    num = FixedMul(projection,sineb)<<detailshift;
+    num = FixedMul(projectiony,sineb)<<detailshift;
     den = FixedMul(rw_distance,sinea);
 
     if (den > num>>16)
@@ -622,7 +639,7 @@ void R_InitLightTables (void)
 	startmap = ((LIGHTLEVELS-1-i)*2)*NUMCOLORMAPS/LIGHTLEVELS;
 	for (j=0 ; j<MAXLIGHTZ ; j++)
 	{
-	    scale = FixedDiv ((SCREENWIDTH/2*FRACUNIT), (j+1)<<LIGHTZSHIFT);
+	    scale = FixedDiv ((ORIGWIDTH/2*FRACUNIT), (j+1)<<LIGHTZSHIFT);
 	    scale >>= LIGHTSCALESHIFT;
 	    level = startmap - scale/DISTMAP;
 	    
@@ -682,8 +699,8 @@ void R_ExecuteSetViewSize (void)
     }
     else
     {
-	scaledviewwidth = setblocks*32;
-	viewheight = (setblocks*168/10)&~7;
+	scaledviewwidth = SCREENX(setblocks*32) & ~1;
+	viewheight = SCREENY((setblocks*168/10)&~7);
     }
     
     detailshift = setdetail;
@@ -694,29 +711,38 @@ void R_ExecuteSetViewSize (void)
     centerxfrac = centerx<<FRACBITS;
     centeryfrac = centery<<FRACBITS;
     projection = centerxfrac;
+    projectiony = ((int64_t) projection * SCREENHEIGHT * ORIGWIDTH)
+                / (SCREENWIDTH * ORIGHEIGHT);
 
     if (!detailshift)
     {
 	colfunc = basecolfunc = R_DrawColumn;
 	fuzzcolfunc = R_DrawFuzzColumn;
 	transcolfunc = R_DrawTranslatedColumn;
-	spanfunc = R_DrawSpan;
+	spanfunc = drawspanfunc;
     }
     else
     {
 	colfunc = basecolfunc = R_DrawColumnLow;
 	fuzzcolfunc = R_DrawFuzzColumnLow;
 	transcolfunc = R_DrawTranslatedColumnLow;
-	spanfunc = R_DrawSpanLow;
+	spanfunc = drawspanlowfunc;
     }
 
+    if (r_deferred)
+	R_DeferDrawers ();
+
     R_InitBuffer (scaledviewwidth, viewheight);
 	
     R_InitTextureMapping ();
     
     // psprite scales
-    pspritescale = FRACUNIT*viewwidth/SCREENWIDTH;
-    pspriteiscale = FRACUNIT*SCREENWIDTH/viewwidth;
+    pspritescale = FRACUNIT*viewwidth/ORIGWIDTH;
+    pspriteiscale = FRACUNIT*ORIGWIDTH/viewwidth;
+    pspriteyscale = ((int64_t) FRACUNIT * viewwidth * SCREENHEIGHT)
+                  / (SCREENWIDTH * ORIGHEIGHT);
+    pspriteyiscale = ((int64_t) FRACUNIT * SCREENWIDTH * ORIGHEIGHT)
+                   / (viewwidth * SCREENHEIGHT);
     
     // thing clipping
     for (i=0 ; i<viewwidth ; i++)
@@ -727,7 +753,7 @@ void R_ExecuteSetViewSize (void)
     {
 	dy = ((i-viewheight/2)<<FRACBITS)+FRACUNIT/2;
 	dy = abs(dy);
-	yslope[i] = FixedDiv ( (viewwidth<<detailshift)/2*FRACUNIT, dy);
+	yslope[i] = FixedDiv (projectiony<<detailshift, dy);
     }
 	
     for (i=0 ; i<viewwidth ; i++)
@@ -743,7 +769,7 @@ void R_ExecuteSetViewSize (void)
 	startmap = ((LIGHTLEVELS-1-i)*2)*NUMCOLORMAPS/LIGHTLEVELS;
 	for (j=0 ; j<MAXLIGHTSCALE ; j++)
 	{
-	    level = startmap - j*SCREENWIDTH/(viewwidth<<detailshift)/DISTMAP;
+	    level = startmap - j*(ORIGWIDTH/2*FRACUNIT)/(projectiony<<detailshift)/DISTMAP;
 	    
 	    if (level < 0)
 		level = 0;
@@ -758,6 +784,173 @@ void R_ExecuteSetViewSize (void)
 
 
 
+//
+// Render threads.
+// The main thread renders the first strip itself.
+// Each worker waits for a frame to start, renders
+//  its strip and reports back.
+//
+#ifdef R_THREADS
+
+typedef struct
+{
+    pthread_t	thread;
+    int		x0;
+    int		x1;
+} renderworker_t;
+
+// [0] is the main thread and is unused
+static renderworker_t	renderworkers[MAXRENDERTHREADS];
+
+static pthread_mutex_t	workerlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	workerstart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	workerdone = PTHREAD_COND_INITIALIZER;
+
+// bumped to start each frame
+static int		workerframe;
+// workers still rendering the current frame
+static int		workersbusy;
+// fuzz position at the start of the frame
+static int		workerfuzzpos;
+// set once the worker threads are running
+static boolean		workersstarted;
+
+static void* R_RenderWorker (void* arg)
+{
+    renderworker_t*	worker = arg;
+    int			frame = 0;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&workerlock);
+	while (workerframe == frame)
+	    pthread_cond_wait (&workerstart, &workerlock);
+	frame = workerframe;
+	pthread_mutex_unlock (&workerlock);
+
+	r_stripx0 = worker->x0;
+	r_stripx1 = worker->x1;
+
+	if (r_stripx0 < r_stripx1)
+	{
+	    // R_SetupFrame and R_ExecuteSetViewSize
+	    //  only set these for the main thread.
+	    colfunc = basecolfunc;
+	    if (fixedcolormap)
+		walllights = scalelightfixed;
+	    fuzzpos = workerfuzzpos;
+
+	    R_ClearClipSegs ();
+	    R_ClearDrawSegs ();
+	    R_ClearPlanes ();
+	    R_ClearSprites ();
+	    if (r_singlewalk)
+		R_ClearWalk ();
+	    R_RenderBSPNode (numnodes-1);
+	    R_DrawPlanes ();
+	    if (r_deferred)
+		R_FlushDrawCommands (true);
+	    R_DrawMasked ();
+	    if (r_deferred)
+		R_FlushDrawCommands (false);
+
+	    if (r_columnmajor)
+		R_CopyViewBuffer ();
+	}
+
+	pthread_mutex_lock (&workerlock);
+	if (--workersbusy == 0)
+	    pthread_cond_signal (&workerdone);
+	pthread_mutex_unlock (&workerlock);
+    }
+
+    return NULL;
+}
+
+//
+// R_StartWorkers
+// Splits the view into strips and starts the workers
+//  on the frame set up by R_SetupFrame.
+//
+static void R_StartWorkers (void)
+{
+    int		strips;
+    int		i;
+
+    // The threads are started with the first frame rather
+    //  than in R_Init, so that a process forked after
+    //  startup (-forkserver) has workers of its own.
+    if (!workersstarted)
+    {
+	for (i=1 ; i<r_numthreads ; i++)
+	{
+	    if (pthread_create (&renderworkers[i].thread, NULL,
+				R_RenderWorker, &renderworkers[i]) != 0)
+		I_Error ("R_StartWorkers: failed to start render thread");
+	}
+	workersstarted = true;
+    }
+
+    // Every strip needs at least one column. Any
+    //  workers left over sit this frame out.
+    strips = r_numthreads < viewwidth ? r_numthreads : viewwidth;
+
+    r_stripx0 = 0;
+    r_stripx1 = viewwidth / strips;
+
+    for (i=1 ; i<r_numthreads ; i++)
+    {
+	if (i < strips)
+	{
+	    renderworkers[i].x0 = viewwidth * i / strips;
+	    renderworkers[i].x1 = viewwidth * (i+1) / strips;
+	}
+	else
+	{
+	    renderworkers[i].x0 = renderworkers[i].x1 = viewwidth;
+	}
+    }
+
+    pthread_mutex_lock (&workerlock);
+    workerfuzzpos = fuzzpos;
+    workersbusy = r_numthreads - 1;
+    workerframe++;
+    pthread_cond_broadcast (&workerstart);
+    pthread_mutex_unlock (&workerlock);
+}
+
+//
+// R_FinishWorkers
+// Waits for the workers to finish the frame.
+//
+static void R_FinishWorkers (void)
+{
+    pthread_mutex_lock (&workerlock);
+    while (workersbusy > 0)
+	pthread_cond_wait (&workerdone, &workerlock);
+    pthread_mutex_unlock (&workerlock);
+
+    R_ReleaseHeldLumps ();
+}
+
+#endif
+
+//
+// R_InitThreads
+//
+static void R_InitThreads (void)
+{
+#ifdef R_THREADS
+    if (r_numthreads < 1 || r_numthreads > MAXRENDERTHREADS)
+	I_Error ("R_InitThreads: %i render threads, must be 1 to %i",
+		 r_numthreads, MAXRENDERTHREADS);
+#else
+    r_numthreads = 1;
+#endif
+}
+
+
+
 //
 // R_Init
 //
@@ -766,7 +959,9 @@ void R_ExecuteSetViewSize (void)
 
 void R_Init (void)
 {
+    M_ProfileBegin ("R_InitData");
     R_InitData ();
+    M_ProfileEnd ();
     printf (".");
     R_InitPointToAngle ();
     printf (".");
@@ -777,11 +972,15 @@ void R_Init (void)
     R_SetViewSize (screenblocks, detailLevel);
     R_InitPlanes ();
     printf (".");
+    M_ProfileBegin ("R_InitLightTables");
     R_InitLightTables ();
+    M_ProfileEnd ();
     printf (".");
     R_InitSkyMap ();
     R_InitTranslationTables ();
+    R_InitSpanFuncs ();
     printf (".");
+    R_InitThreads ();
 	
     framecount = 0;
 }
@@ -867,10 +1066,16 @@ void R_RenderPlayerView (player_t* player)
 
     // Clear buffers.
     DOOMCLI_READ_INPUT();
+#ifdef R_THREADS
+    if (r_numthreads > 1)
+	R_StartWorkers ();
+#endif
     R_ClearClipSegs ();
     R_ClearDrawSegs ();
     R_ClearPlanes ();
     R_ClearSprites ();
+    if (r_singlewalk)
+	R_ClearWalk ();
     
     // check for new console commands.
     DOOMCLI_READ_INPUT();
@@ -884,6 +1089,9 @@ void R_RenderPlayerView (player_t* player)
     NetUpdate ();
     
     R_DrawPlanes ();
+
+    if (r_deferred)
+	R_FlushDrawCommands (true);
     
     // Check for new console commands.
     DOOMCLI_READ_INPUT();
@@ -891,6 +1099,23 @@ void R_RenderPlayerView (player_t* player)
     
     R_DrawMasked ();
 
+    if (r_deferred)
+	R_FlushDrawCommands (false);
+
+    if (r_columnmajor)
+	R_CopyViewBuffer ();
+
+#ifdef R_THREADS
+    if (r_numthreads > 1)
+	R_FinishWorkers ();
+#endif
+
+    R_MarkMappedLines ();
+
+    // lumps held for the deferred drawing can be purged again
+    if (r_deferred)
+	R_ReleaseHeldLumps ();
+
     // Check for new console commands.
     DOOMCLI_READ_INPUT();
     NetUpdate ();				
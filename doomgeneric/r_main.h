@@ -43,6 +43,7 @@ extern int		centery;
 extern fixed_t		centerxfrac;
 extern fixed_t		centeryfrac;
 extern fixed_t		projection;
+extern fixed_t		projectiony;
 
 extern int		validcount;
 
@@ -89,7 +90,7 @@ extern	int		detailshift;
 // Function pointers to switch refresh/drawing functions.
 // Used to select shadow mode etc.
 //
-extern void		(*colfunc) (void);
+extern R_THREADLOCAL void (*colfunc) (void);
 extern void		(*transcolfunc) (void);
 extern void		(*basecolfunc) (void);
 extern void		(*fuzzcolfunc) (void);
@@ -97,6 +98,23 @@ extern void		(*fuzzcolfunc) (void);
 extern void		(*spanfunc) (void);
 
 
+//
+// Render threads.
+// The view can be split into vertical strips, each rendered on its own
+// thread. Every thread does the full BSP traversal and bookkeeping for the
+// whole view but only draws the columns of its strip, so the frame comes
+// out exactly as it would on one thread.
+//
+#define MAXRENDERTHREADS	16
+
+// Set by the platform before R_Init. 1 renders on the calling thread.
+extern int		r_numthreads;
+
+// The view columns this thread draws, [r_stripx0, r_stripx1).
+extern R_THREADLOCAL int	r_stripx0;
+extern R_THREADLOCAL int	r_stripx1;
+
+
 //
 // Utility functions.
 int
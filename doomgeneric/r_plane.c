@@ -42,48 +42,70 @@ planefunction_t		ceilingfunc;
 //
 
 // Here comes the obnoxious "visplane".
-#define MAXVISPLANES	128
-visplane_t		visplanes[MAXVISPLANES];
-visplane_t*		lastvisplane;
-visplane_t*		floorplane;
-visplane_t*		ceilingplane;
-
-// ?
-#define MAXOPENINGS	SCREENWIDTH*64
-short			openings[MAXOPENINGS];
-short*			lastopening;
+// The pool grows as needed and is reused from frame to frame. The
+//  planes are allocated one by one so the floorplane and ceilingplane
+//  pointers stay valid when it grows.
+R_THREADLOCAL visplane_t**		visplanes;
+R_THREADLOCAL int			numvisplanes;
+R_THREADLOCAL int			maxvisplanes;
+R_THREADLOCAL visplane_t*		floorplane;
+R_THREADLOCAL visplane_t*		ceilingplane;
+
+// Visplanes are found through a hash on height, picnum and light level.
+//  Planes that share a key are chained in the order they were made,
+//  so R_FindPlane returns the same plane the linear search did.
+#define VISPLANEHASHSIZE	512
+#define VISPLANEHASH(height,picnum,lightlevel) \
+	(((unsigned)(height)*7 + (unsigned)(picnum)*3 + (unsigned)(lightlevel)) \
+	 & (VISPLANEHASHSIZE-1))
+
+static R_THREADLOCAL visplane_t*	visplanehash[VISPLANEHASHSIZE];
+
+// Openings are carved out of a list of blocks that is kept between
+//  frames. New blocks are added when a frame needs more. Each request
+//  is at most a screen wide so it always fits in one block.
+#define OPENINGBLOCKSIZE	(MAXWIDTH*16)
+
+typedef struct openingblock_s
+{
+    struct openingblock_s*	next;
+    short			openings[OPENINGBLOCKSIZE];
+} openingblock_t;
 
+static R_THREADLOCAL openingblock_t*	openingblocks;
+static R_THREADLOCAL openingblock_t*	curopeningblock;
+static R_THREADLOCAL short*		lastopening;
 
 //
 // Clip values are the solid pixel bounding the range.
 //  floorclip starts out SCREENHEIGHT
 //  ceilingclip starts out -1
 //
-short			floorclip[SCREENWIDTH];
-short			ceilingclip[SCREENWIDTH];
+R_THREADLOCAL short			floorclip[MAXWIDTH];
+R_THREADLOCAL short			ceilingclip[MAXWIDTH];
 
 //
 // spanstart holds the start of a plane span
 // initialized to 0 at start
 //
-int			spanstart[SCREENHEIGHT];
-int			spanstop[SCREENHEIGHT];
+R_THREADLOCAL int			spanstart[MAXHEIGHT];
+R_THREADLOCAL int			spanstop[MAXHEIGHT];
 
 //
 // texture mapping
 //
-lighttable_t**		planezlight;
-fixed_t			planeheight;
+R_THREADLOCAL lighttable_t**		planezlight;
+R_THREADLOCAL fixed_t			planeheight;
 
-fixed_t			yslope[SCREENHEIGHT];
-fixed_t			distscale[SCREENWIDTH];
-fixed_t			basexscale;
-fixed_t			baseyscale;
+fixed_t			yslope[MAXHEIGHT];
+fixed_t			distscale[MAXWIDTH];
+R_THREADLOCAL fixed_t			basexscale;
+R_THREADLOCAL fixed_t			baseyscale;
 
-fixed_t			cachedheight[SCREENHEIGHT];
-fixed_t			cacheddistance[SCREENHEIGHT];
-fixed_t			cachedxstep[SCREENHEIGHT];
-fixed_t			cachedystep[SCREENHEIGHT];
+R_THREADLOCAL fixed_t			cachedheight[MAXHEIGHT];
+R_THREADLOCAL fixed_t			cacheddistance[MAXHEIGHT];
+R_THREADLOCAL fixed_t			cachedxstep[MAXHEIGHT];
+R_THREADLOCAL fixed_t			cachedystep[MAXHEIGHT];
 
 
 
@@ -131,6 +153,10 @@ R_MapPlane
     }
 #endif
 
+    // None of it in this thread's strip?
+    if (x2 < r_stripx0 || x1 >= r_stripx1)
+	return;
+
     if (planeheight != cachedheight[y])
     {
 	cachedheight[y] = planeheight;
@@ -167,7 +193,8 @@ R_MapPlane
     ds_x2 = x2;
 
     // high or low detail
-    spanfunc ();	
+    if (R_ClipSpan ())
+	spanfunc ();	
 }
 
 
@@ -187,8 +214,11 @@ void R_ClearPlanes (void)
 	ceilingclip[i] = -1;
     }
 
-    lastvisplane = visplanes;
-    lastopening = openings;
+    numvisplanes = 0;
+    memset (visplanehash, 0, sizeof(visplanehash));
+
+    curopeningblock = openingblocks;
+    lastopening = openingblocks ? openingblocks->openings : NULL;
     
     // texture calculation
     memset (cachedheight, 0, sizeof(cachedheight));
@@ -204,6 +234,74 @@ void R_ClearPlanes (void)
 
 
 
+//
+// R_NewVisplane
+// Takes the next plane from the pool, growing it if needed.
+//
+static visplane_t* R_NewVisplane (void)
+{
+    if (numvisplanes == maxvisplanes)
+    {
+	int		newmax = maxvisplanes ? maxvisplanes*2 : 128;
+	visplane_t**	newplanes;
+
+	newplanes = realloc(visplanes, newmax * sizeof(*visplanes));
+	if (newplanes == NULL)
+	    I_Error ("R_NewVisplane: out of memory (%i visplanes)", newmax);
+	memset (newplanes + maxvisplanes, 0,
+		(newmax - maxvisplanes) * sizeof(*visplanes));
+	visplanes = newplanes;
+	maxvisplanes = newmax;
+    }
+
+    if (visplanes[numvisplanes] == NULL)
+    {
+	// Zeroed like the old static array: R_DrawPlane reads
+	//  bottom[] and the pads in columns the plane doesn't cover.
+	visplanes[numvisplanes] = calloc(1, sizeof(visplane_t));
+	if (visplanes[numvisplanes] == NULL)
+	    I_Error ("R_NewVisplane: out of memory");
+    }
+
+    return visplanes[numvisplanes++];
+}
+
+
+//
+// R_NewOpenings
+// Returns room for count clip values, at most MAXWIDTH.
+//
+short* R_NewOpenings (int count)
+{
+    short*	result;
+
+    if (curopeningblock == NULL
+	|| lastopening + count > curopeningblock->openings + OPENINGBLOCKSIZE)
+    {
+	openingblock_t*	next;
+
+	next = curopeningblock ? curopeningblock->next : openingblocks;
+	if (next == NULL)
+	{
+	    next = malloc(sizeof(openingblock_t));
+	    if (next == NULL)
+		I_Error ("R_NewOpenings: out of memory");
+	    next->next = NULL;
+	    if (curopeningblock)
+		curopeningblock->next = next;
+	    else
+		openingblocks = next;
+	}
+	curopeningblock = next;
+	lastopening = next->openings;
+    }
+
+    result = lastopening;
+    lastopening += count;
+    return result;
+}
+
+
 //
 // R_FindPlane
 //
@@ -214,6 +312,7 @@ R_FindPlane
   int		lightlevel )
 {
     visplane_t*	check;
+    unsigned	hash;
 	
     if (picnum == skyflatnum)
     {
@@ -221,24 +320,21 @@ R_FindPlane
 	lightlevel = 0;
     }
 	
-    for (check=visplanes; check<lastvisplane; check++)
+    hash = VISPLANEHASH(height, picnum, lightlevel);
+
+    for (check=visplanehash[hash]; check; check=check->next)
     {
 	if (height == check->height
 	    && picnum == check->picnum
 	    && lightlevel == check->lightlevel)
 	{
-	    break;
+	    return check;
 	}
     }
-    
-			
-    if (check < lastvisplane)
-	return check;
-		
-    if (lastvisplane - visplanes == MAXVISPLANES)
-	I_Error ("R_FindPlane: no more visplanes");
-		
-    lastvisplane++;
+
+    check = R_NewVisplane ();
+    check->next = visplanehash[hash];
+    visplanehash[hash] = check;
 
     check->height = height;
     check->picnum = picnum;
@@ -261,6 +357,7 @@ R_CheckPlane
   int		start,
   int		stop )
 {
+    visplane_t*	check;
     int		intrl;
     int		intrh;
     int		unionl;
@@ -290,7 +387,7 @@ R_CheckPlane
     }
 
     for (x=intrl ; x<= intrh ; x++)
-	if (pl->top[x] != 0xff)
+	if (pl->top[x] != 0xffff)
 	    break;
 
     if (x > intrh)
@@ -302,12 +399,26 @@ R_CheckPlane
 	return pl;		
     }
 	
-    // make a new visplane
-    lastvisplane->height = pl->height;
-    lastvisplane->picnum = pl->picnum;
-    lastvisplane->lightlevel = pl->lightlevel;
+    if (r_singlewalk)
+    {
+	// Planes are drawn a subsector at a time (see r_walk.c.)
+	//  Draw what's marked so far and start over.
+	R_WalkFlushPlane (pl);
+	pl->minx = start;
+	pl->maxx = stop;
+	return pl;
+    }
+
+    // make a new visplane, chained after the first
+    //  plane with the same key so R_FindPlane still finds that one
+    check = R_NewVisplane ();
+    check->height = pl->height;
+    check->picnum = pl->picnum;
+    check->lightlevel = pl->lightlevel;
+    check->next = pl->next;
+    pl->next = check;
     
-    pl = lastvisplane++;
+    pl = check;
     pl->minx = start;
     pl->maxx = stop;
 
@@ -354,102 +465,101 @@ R_MakeSpans
 
 
 //
-// R_DrawPlanes
-// At the end of each frame.
+// R_DrawPlane
 //
-void R_DrawPlanes (void)
+void R_DrawPlane (visplane_t* pl)
 {
-    visplane_t*		pl;
     int			light;
     int			x;
     int			stop;
     int			angle;
     int                 lumpnum;
-				
-#ifdef RANGECHECK
-    if (ds_p - drawsegs > MAXDRAWSEGS)
-	I_Error ("R_DrawPlanes: drawsegs overflow (%i)",
-		 ds_p - drawsegs);
-    
-    if (lastvisplane - visplanes > MAXVISPLANES)
-	I_Error ("R_DrawPlanes: visplane overflow (%i)",
-		 lastvisplane - visplanes);
-    
-    if (lastopening - openings > MAXOPENINGS)
-	I_Error ("R_DrawPlanes: opening overflow (%i)",
-		 lastopening - openings);
-#endif
 
-    for (pl = visplanes ; pl < lastvisplane ; pl++)
-    {
-	if (pl->minx > pl->maxx)
-	    continue;
+    if (pl->minx > pl->maxx)
+	return;
+
+    if (pl->maxx < r_stripx0 || pl->minx >= r_stripx1)
+	return;
 
     DOOMCLI_READ_INPUT();
 	
-	// sky flat
-	if (pl->picnum == skyflatnum)
-	{
-	    dc_iscale = pspriteiscale>>detailshift;
+    // sky flat
+    if (pl->picnum == skyflatnum)
+    {
+	dc_iscale = pspriteyiscale>>detailshift;
 	    
-	    // Sky is allways drawn full bright,
-	    //  i.e. colormaps[0] is used.
-	    // Because of this hack, sky is not affected
-	    //  by INVUL inverse mapping.
-	    dc_colormap = colormaps;
-	    dc_texturemid = skytexturemid;
-	    for (x=pl->minx ; x <= pl->maxx ; x++)
+	// Sky is allways drawn full bright,
+	//  i.e. colormaps[0] is used.
+	// Because of this hack, sky is not affected
+	//  by INVUL inverse mapping.
+	dc_colormap = colormaps;
+	dc_texturemid = skytexturemid;
+	x = pl->minx < r_stripx0 ? r_stripx0 : pl->minx;
+	stop = pl->maxx < r_stripx1 ? pl->maxx : r_stripx1 - 1;
+	for ( ; x <= stop ; x++)
+	{
+	    if (!(x & 0x1f)) {
+		    DOOMCLI_READ_INPUT();
+	    }
+	    dc_yl = pl->top[x];
+	    dc_yh = pl->bottom[x];
+
+	    if (dc_yl <= dc_yh)
 	    {
-		if (!(x & 0x1f)) {
-			DOOMCLI_READ_INPUT();
-		}
-		dc_yl = pl->top[x];
-		dc_yh = pl->bottom[x];
-
-		if (dc_yl <= dc_yh)
-		{
-		    angle = (viewangle + xtoviewangle[x])>>ANGLETOSKYSHIFT;
-		    dc_x = x;
-		    dc_source = R_GetColumn(skytexture, angle);
-		    colfunc ();
-		}
+		angle = (viewangle + xtoviewangle[x])>>ANGLETOSKYSHIFT;
+		dc_x = x;
+		dc_source = R_GetColumn(skytexture, angle);
+		colfunc ();
 	    }
-	    continue;
 	}
+	return;
+    }
 	
-	// regular flat
-        lumpnum = firstflat + flattranslation[pl->picnum];
-	ds_source = W_CacheLumpNum(lumpnum, PU_STATIC);
+    // regular flat
+    lumpnum = firstflat + flattranslation[pl->picnum];
+    ds_source = R_CacheLumpNum(lumpnum, PU_STATIC);
 	
-	planeheight = abs(pl->height-viewz);
-	light = (pl->lightlevel >> LIGHTSEGSHIFT)+extralight;
+    planeheight = abs(pl->height-viewz);
+    light = (pl->lightlevel >> LIGHTSEGSHIFT)+extralight;
 
-	if (light >= LIGHTLEVELS)
-	    light = LIGHTLEVELS-1;
+    if (light >= LIGHTLEVELS)
+	light = LIGHTLEVELS-1;
 
-	if (light < 0)
-	    light = 0;
+    if (light < 0)
+	light = 0;
 
-	planezlight = zlight[light];
+    planezlight = zlight[light];
 
-	pl->top[pl->maxx+1] = 0xff;
-	pl->top[pl->minx-1] = 0xff;
+    pl->top[pl->maxx+1] = 0xffff;
+    pl->top[pl->minx-1] = 0xffff;
 		
-	stop = pl->maxx + 1;
+    stop = pl->maxx + 1;
 
-	DOOMCLI_READ_INPUT();
-	for (x=pl->minx ; x<= stop ; x++)
-	{
-		if (!(x & 0x1f)) {
-			DOOMCLI_READ_INPUT();
-		}
-	    R_MakeSpans(x,pl->top[x-1],
-			pl->bottom[x-1],
-			pl->top[x],
-			pl->bottom[x]);
-	}
-	DOOMCLI_READ_INPUT();
-	
-        W_ReleaseLumpNum(lumpnum);
+    DOOMCLI_READ_INPUT();
+    for (x=pl->minx ; x<= stop ; x++)
+    {
+	    if (!(x & 0x1f)) {
+		    DOOMCLI_READ_INPUT();
+	    }
+	R_MakeSpans(x,pl->top[x-1],
+		    pl->bottom[x-1],
+		    pl->top[x],
+		    pl->bottom[x]);
     }
+    DOOMCLI_READ_INPUT();
+	
+    R_ReleaseLumpNum(lumpnum);
+}
+
+
+//
+// R_DrawPlanes
+// At the end of each frame.
+//
+void R_DrawPlanes (void)
+{
+    int			i;
+				
+    for (i = 0 ; i < numvisplanes ; i++)
+	R_DrawPlane (visplanes[i]);
 }
@@ -26,7 +26,7 @@
 
 
 // Visplane related.
-extern  short*		lastopening;
+short* R_NewOpenings (int count);
 
 
 typedef void (*planefunction_t) (int top, int bottom);
@@ -34,11 +34,11 @@ typedef void (*planefunction_t) (int top, int bottom);
 extern planefunction_t	floorfunc;
 extern planefunction_t	ceilingfunc_t;
 
-extern short		floorclip[SCREENWIDTH];
-extern short		ceilingclip[SCREENWIDTH];
+extern R_THREADLOCAL short		floorclip[MAXWIDTH];
+extern R_THREADLOCAL short		ceilingclip[MAXWIDTH];
 
-extern fixed_t		yslope[SCREENHEIGHT];
-extern fixed_t		distscale[SCREENWIDTH];
+extern fixed_t		yslope[MAXHEIGHT];
+extern fixed_t		distscale[MAXWIDTH];
 
 void R_InitPlanes (void);
 void R_ClearPlanes (void);
@@ -57,6 +57,7 @@ R_MakeSpans
   int		t2,
   int		b2 );
 
+void R_DrawPlane (visplane_t* pl);
 void R_DrawPlanes (void);
 
 visplane_t*
@@ -36,56 +36,56 @@
 // OPTIMIZE: closed two sided lines as single sided
 
 // True if any of the segs textures might be visible.
-boolean		segtextured;	
+R_THREADLOCAL boolean		segtextured;	
 
 // False if the back side is the same plane.
-boolean		markfloor;	
-boolean		markceiling;
+R_THREADLOCAL boolean		markfloor;	
+R_THREADLOCAL boolean		markceiling;
 
-boolean		maskedtexture;
-int		toptexture;
-int		bottomtexture;
-int		midtexture;
+R_THREADLOCAL boolean		maskedtexture;
+R_THREADLOCAL int		toptexture;
+R_THREADLOCAL int		bottomtexture;
+R_THREADLOCAL int		midtexture;
 
 
-angle_t		rw_normalangle;
+R_THREADLOCAL angle_t		rw_normalangle;
 // angle to line origin
-int		rw_angle1;	
+R_THREADLOCAL int		rw_angle1;	
 
 //
 // regular wall
 //
-int		rw_x;
-int		rw_stopx;
-angle_t		rw_centerangle;
-fixed_t		rw_offset;
-fixed_t		rw_distance;
-fixed_t		rw_scale;
-fixed_t		rw_scalestep;
-fixed_t		rw_midtexturemid;
-fixed_t		rw_toptexturemid;
-fixed_t		rw_bottomtexturemid;
+R_THREADLOCAL int		rw_x;
+R_THREADLOCAL int		rw_stopx;
+R_THREADLOCAL angle_t		rw_centerangle;
+R_THREADLOCAL fixed_t		rw_offset;
+R_THREADLOCAL fixed_t		rw_distance;
+R_THREADLOCAL fixed_t		rw_scale;
+R_THREADLOCAL fixed_t		rw_scalestep;
+R_THREADLOCAL fixed_t		rw_midtexturemid;
+R_THREADLOCAL fixed_t		rw_toptexturemid;
+R_THREADLOCAL fixed_t		rw_bottomtexturemid;
 
-int		worldtop;
-int		worldbottom;
-int		worldhigh;
-int		worldlow;
+R_THREADLOCAL int		worldtop;
+R_THREADLOCAL int		worldbottom;
+R_THREADLOCAL int		worldhigh;
+R_THREADLOCAL int		worldlow;
 
-fixed_t		pixhigh;
-fixed_t		pixlow;
-fixed_t		pixhighstep;
-fixed_t		pixlowstep;
+R_THREADLOCAL fixed_t		pixhigh;
+R_THREADLOCAL fixed_t		pixlow;
+R_THREADLOCAL fixed_t		pixhighstep;
+R_THREADLOCAL fixed_t		pixlowstep;
 
-fixed_t		topfrac;
-fixed_t		topstep;
+R_THREADLOCAL fixed_t		topfrac;
+R_THREADLOCAL fixed_t		topstep;
 
-fixed_t		bottomfrac;
-fixed_t		bottomstep;
+R_THREADLOCAL fixed_t		bottomfrac;
+R_THREADLOCAL fixed_t		bottomstep;
 
 
-lighttable_t**	walllights;
+R_THREADLOCAL lighttable_t**	walllights;
 
-short*		maskedtexturecol;
+R_THREADLOCAL short*		maskedtexturecol;
 
 
 
@@ -102,6 +102,14 @@ R_RenderMaskedSegRange
     column_t*	col;
     int		lightnum;
     int		texnum;
+
+    // Only this thread's strip is drawn.
+    if (x1 < r_stripx0)
+	x1 = r_stripx0;
+    if (x2 >= r_stripx1)
+	x2 = r_stripx1 - 1;
+    if (x1 > x2)
+	return;
     
     // Calculate light table.
     // Use different light tables
@@ -206,9 +214,15 @@ void R_RenderSegLoop (void)
     fixed_t		texturecolumn;
     int			top;
     int			bottom;
+    boolean		draw;
 
     for ( ; rw_x < rw_stopx ; rw_x++)
     {
+	// Clipping and marking is done across the whole view,
+	//  but only columns in this thread's strip are drawn,
+	//  so only they need texturing and lighting.
+	draw = rw_x >= r_stripx0 && rw_x < r_stripx1;
+
 	// mark floor / ceiling areas
 	yl = (topfrac+HEIGHTUNIT-1)>>HEIGHTBITS;
 
@@ -250,7 +264,7 @@ void R_RenderSegLoop (void)
 	}
 	
 	// texturecolumn and lighting are independent of wall tiers
-	if (segtextured)
+	if (segtextured && draw)
 	{
 	    // calculate texture offset
 	    angle = (rw_centerangle + xtoviewangle[rw_x])>>ANGLETOFINESHIFT;
@@ -280,8 +294,11 @@ void R_RenderSegLoop (void)
 	    dc_yl = yl;
 	    dc_yh = yh;
 	    dc_texturemid = rw_midtexturemid;
-	    dc_source = R_GetColumn(midtexture,texturecolumn);
-	    colfunc ();
+	    if (draw)
+	    {
+		dc_source = R_GetColumn(midtexture,texturecolumn);
+		colfunc ();
+	    }
 	    ceilingclip[rw_x] = viewheight;
 	    floorclip[rw_x] = -1;
 	}
@@ -302,8 +319,11 @@ void R_RenderSegLoop (void)
 		    dc_yl = yl;
 		    dc_yh = mid;
 		    dc_texturemid = rw_toptexturemid;
-		    dc_source = R_GetColumn(toptexture,texturecolumn);
-		    colfunc ();
+		    if (draw)
+		    {
+			dc_source = R_GetColumn(toptexture,texturecolumn);
+			colfunc ();
+		    }
 		    ceilingclip[rw_x] = mid;
 		}
 		else
@@ -331,9 +351,12 @@ void R_RenderSegLoop (void)
 		    dc_yl = mid;
 		    dc_yh = yh;
 		    dc_texturemid = rw_bottomtexturemid;
-		    dc_source = R_GetColumn(bottomtexture,
-					    texturecolumn);
-		    colfunc ();
+		    if (draw)
+		    {
+			dc_source = R_GetColumn(bottomtexture,
+						texturecolumn);
+			colfunc ();
+		    }
 		    floorclip[rw_x] = mid;
 		}
 		else
@@ -346,10 +369,11 @@ void R_RenderSegLoop (void)
 		    floorclip[rw_x] = yh+1;
 	    }
 			
-	    if (maskedtexture)
+	    if (maskedtexture && draw)
 	    {
 		// save texturecol
 		//  for backdrawing of masked mid texture
+		//  (only read back in this thread's strip)
 		maskedtexturecol[rw_x] = texturecolumn;
 	    }
 	}
@@ -379,9 +403,19 @@ R_StoreWallRange
     fixed_t		vtop;
     int			lightnum;
 
-    // don't overflow and crash
-    if (ds_p == &drawsegs[MAXDRAWSEGS])
-	return;		
+    // make room for another drawseg
+    if (ds_p == drawsegs + maxdrawsegs)
+    {
+	int		newmax = maxdrawsegs ? maxdrawsegs*2 : MAXDRAWSEGS;
+	drawseg_t*	newsegs;
+
+	newsegs = realloc(drawsegs, newmax * sizeof(*drawsegs));
+	if (newsegs == NULL)
+	    I_Error ("R_StoreWallRange: out of memory (%i drawsegs)", newmax);
+	ds_p = newsegs + maxdrawsegs;
+	drawsegs = newsegs;
+	maxdrawsegs = newmax;
+    }
 		
 #ifdef RANGECHECK
     if (start >=viewwidth || start > stop)
@@ -391,9 +425,6 @@ R_StoreWallRange
     sidedef = curline->sidedef;
     linedef = curline->linedef;
 
-    // mark the segment as visible for auto map
-    linedef->flags |= ML_MAPPED;
-    
     // calculate rw_distance for scale calculation
     rw_normalangle = curline->angle + ANG90;
     offsetangle = abs(rw_normalangle-rw_angle1);
@@ -605,8 +636,8 @@ R_StoreWallRange
 	{
 	    // masked midtexture
 	    maskedtexture = true;
-	    ds_p->maskedtexturecol = maskedtexturecol = lastopening - rw_x;
-	    lastopening += rw_stopx - rw_x;
+	    maskedtexturecol = R_NewOpenings (rw_stopx - rw_x) - rw_x;
+	    ds_p->maskedtexturecol = maskedtexturecol;
 	}
     }
     
@@ -715,17 +746,15 @@ R_StoreWallRange
     if ( ((ds_p->silhouette & SIL_TOP) || maskedtexture)
 	 && !ds_p->sprtopclip)
     {
-	memcpy (lastopening, ceilingclip+start, 2*(rw_stopx-start));
-	ds_p->sprtopclip = lastopening - start;
-	lastopening += rw_stopx - start;
+	ds_p->sprtopclip = R_NewOpenings (rw_stopx - start) - start;
+	memcpy (ds_p->sprtopclip+start, ceilingclip+start, 2*(rw_stopx-start));
     }
     
     if ( ((ds_p->silhouette & SIL_BOTTOM) || maskedtexture)
 	 && !ds_p->sprbottomclip)
     {
-	memcpy (lastopening, floorclip+start, 2*(rw_stopx-start));
-	ds_p->sprbottomclip = lastopening - start;
-	lastopening += rw_stopx - start;	
+	ds_p->sprbottomclip = R_NewOpenings (rw_stopx - start) - start;
+	memcpy (ds_p->sprbottomclip+start, floorclip+start, 2*(rw_stopx-start));
     }
 
     if (maskedtexture && !(ds_p->silhouette&SIL_TOP))
@@ -741,3 +770,18 @@ R_StoreWallRange
     ds_p++;
 }
 
+
+
+//
+// R_MarkMappedLines
+// Marks the segments stored this frame as visible for the
+//  auto map. This is left until the other strips are done,
+//  as they read the linedef flags while drawing.
+//
+void R_MarkMappedLines (void)
+{
+    drawseg_t*	ds;
+
+    for (ds = drawsegs ; ds < ds_p ; ds++)
+	ds->curline->linedef->flags |= ML_MAPPED;
+}
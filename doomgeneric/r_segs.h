@@ -29,5 +29,7 @@ R_RenderMaskedSegRange
   int		x1,
   int		x2 );
 
+void R_MarkMappedLines (void);
+
 
 #endif
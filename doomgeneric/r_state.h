@@ -106,22 +106,22 @@ extern player_t*	viewplayer;
 extern angle_t		clipangle;
 
 extern int		viewangletox[FINEANGLES/2];
-extern angle_t		xtoviewangle[SCREENWIDTH+1];
+extern angle_t		xtoviewangle[MAXWIDTH+1];
 //extern fixed_t		finetangent[FINEANGLES/2];
 
-extern fixed_t		rw_distance;
-extern angle_t		rw_normalangle;
+extern R_THREADLOCAL fixed_t		rw_distance;
+extern R_THREADLOCAL angle_t		rw_normalangle;
 
 
 
 // angle to line origin
-extern int		rw_angle1;
+extern R_THREADLOCAL int		rw_angle1;
 
 // Segs count?
-extern int		sscount;
+extern R_THREADLOCAL int		sscount;
 
-extern visplane_t*	floorplane;
-extern visplane_t*	ceilingplane;
+extern R_THREADLOCAL visplane_t*	floorplane;
+extern R_THREADLOCAL visplane_t*	ceilingplane;
 
 
 #endif
@@ -67,13 +67,15 @@ typedef struct
 //
 fixed_t		pspritescale;
 fixed_t		pspriteiscale;
+fixed_t		pspriteyscale;
+fixed_t		pspriteyiscale;
 
-lighttable_t**	spritelights;
+R_THREADLOCAL lighttable_t**	spritelights;
 
 // constant arrays
 //  used for psprite clipping and initializing clipping
-short		negonearray[SCREENWIDTH];
-short		screenheightarray[SCREENWIDTH];
+short		negonearray[MAXWIDTH];
+short		screenheightarray[MAXWIDTH];
 
 
 //
@@ -178,6 +180,7 @@ void R_InitSpriteDefs (char** namelist)
     int		start;
     int		end;
     int		patched;
+    uint64_t	spritekey;
 		
     // count the number of sprite names
     check = namelist;
@@ -190,6 +193,10 @@ void R_InitSpriteDefs (char** namelist)
 	return;
 		
     sprites = Z_Malloc(numsprites *sizeof(*sprites), PU_STATIC, NULL);
+
+    // Same WADs as last time?  See r_data.c.
+    if (R_UseBakedSpriteDefs (namelist))
+	return;
 	
     start = firstspritelump-1;
     end = lastspritelump+1;
@@ -200,6 +207,7 @@ void R_InitSpriteDefs (char** namelist)
     for (i=0 ; i<numsprites ; i++)
     {
 	spritename = DEH_String(namelist[i]);
+	spritekey = W_LumpNameKey(spritename) & 0xffffffff;
 	memset (sprtemp,-1, sizeof(sprtemp));
 		
 	maxframe = -1;
@@ -208,7 +216,7 @@ void R_InitSpriteDefs (char** namelist)
 	//  filling in the frames for whatever is found
 	for (l=start+1 ; l<end ; l++)
 	{
-	    if (!strncasecmp(lumpinfo[l].name, spritename, 4))
+	    if ((lumpinfo[l].key & 0xffffffff) == spritekey)
 	    {
 		frame = lumpinfo[l].name[4] - 'A';
 		rotation = lumpinfo[l].name[5] - '0';
@@ -278,9 +286,11 @@ void R_InitSpriteDefs (char** namelist)
 //
 // GAME FUNCTIONS
 //
-vissprite_t	vissprites[MAXVISSPRITES];
-vissprite_t*	vissprite_p;
-int		newvissprite;
+// Grows as needed in R_NewVisSprite and is reused between frames.
+R_THREADLOCAL vissprite_t*	vissprites;
+R_THREADLOCAL vissprite_t*	vissprite_p;
+R_THREADLOCAL int		maxvissprites;
+R_THREADLOCAL int		newvissprite;
 
 
 
@@ -298,10 +308,17 @@ void R_InitSprites (char** namelist)
     }
 	
     R_InitSpriteDefs (namelist);
+    R_SaveBakedData (namelist);
 }
 
 
 
+// Marks the sectors whose sprites have been added this frame.
+// Each render thread needs its own, so sector_t's validcount
+//  can't be used for this.
+static R_THREADLOCAL int*	sectorframe;
+static R_THREADLOCAL int	numsectorframes;
+
 //
 // R_ClearSprites
 // Called at frame start.
@@ -309,18 +326,36 @@ void R_InitSprites (char** namelist)
 void R_ClearSprites (void)
 {
     vissprite_p = vissprites;
+
+    if (numsectorframes < numsectors)
+    {
+	// Zero never matches validcount, which starts at 1.
+	free(sectorframe);
+	sectorframe = calloc(numsectors, sizeof(*sectorframe));
+	if (sectorframe == NULL)
+	    I_Error ("R_ClearSprites: out of memory");
+	numsectorframes = numsectors;
+    }
 }
 
 
 //
 // R_NewVisSprite
 //
-vissprite_t	overflowsprite;
-
 vissprite_t* R_NewVisSprite (void)
 {
-    if (vissprite_p == &vissprites[MAXVISSPRITES])
-	return &overflowsprite;
+    if (vissprite_p == vissprites + maxvissprites)
+    {
+	int		newmax = maxvissprites ? maxvissprites*2 : MAXVISSPRITES;
+	vissprite_t*	newsprites;
+
+	newsprites = realloc(vissprites, newmax * sizeof(*vissprites));
+	if (newsprites == NULL)
+	    I_Error ("R_NewVisSprite: out of memory (%i vissprites)", newmax);
+	vissprite_p = newsprites + maxvissprites;
+	vissprites = newsprites;
+	maxvissprites = newmax;
+    }
     
     vissprite_p++;
     return vissprite_p-1;
@@ -334,11 +369,11 @@ vissprite_t* R_NewVisSprite (void)
 // Masked means: partly transparent, i.e. stored
 //  in posts/runs of opaque pixels.
 //
-short*		mfloorclip;
-short*		mceilingclip;
+R_THREADLOCAL short*		mfloorclip;
+R_THREADLOCAL short*		mceilingclip;
 
-fixed_t		spryscale;
-fixed_t		sprtopscreen;
+R_THREADLOCAL fixed_t		spryscale;
+R_THREADLOCAL fixed_t		sprtopscreen;
 
 void R_DrawMaskedColumn (column_t* column)
 {
@@ -396,8 +431,19 @@ R_DrawVisSprite
     fixed_t		frac;
     patch_t*		patch;
 	
+    // Only this thread's strip is drawn. Shadows still step
+    //  through every column to keep the fuzz sequence in step.
+    if (vis->colormap)
+    {
+	if (x1 < r_stripx0)
+	    x1 = r_stripx0;
+	if (x2 >= r_stripx1)
+	    x2 = r_stripx1 - 1;
+	if (x1 > x2)
+	    return;
+    }
 	
-    patch = W_CacheLumpNum (vis->patch+firstspritelump, PU_CACHE);
+    patch = R_CacheLumpNum (vis->patch+firstspritelump, PU_CACHE);
 
     dc_colormap = vis->colormap;
     
@@ -413,13 +459,13 @@ R_DrawVisSprite
 	    ( (vis->mobjflags & MF_TRANSLATION) >> (MF_TRANSSHIFT-8) );
     }
 	
-    dc_iscale = abs(vis->xiscale)>>detailshift;
+    dc_iscale = vis->yiscale>>detailshift;
     dc_texturemid = vis->texturemid;
-    frac = vis->startfrac;
+    frac = vis->startfrac + (x1 - vis->x1)*vis->xiscale;
     spryscale = vis->scale;
     sprtopscreen = centeryfrac - FixedMul(dc_texturemid,spryscale);
 	
-    for (dc_x=vis->x1 ; dc_x<=vis->x2 ; dc_x++, frac += vis->xiscale)
+    for (dc_x=x1 ; dc_x<=x2 ; dc_x++, frac += vis->xiscale)
     {
 	texturecolumn = frac>>FRACBITS;
 #ifdef RANGECHECK
@@ -453,6 +499,7 @@ void R_ProjectSprite (mobj_t* thing)
     fixed_t		tz;
 
     fixed_t		xscale;
+    fixed_t		yscale;
     
     int			x1;
     int			x2;
@@ -485,6 +532,7 @@ void R_ProjectSprite (mobj_t* thing)
 	return;
     
     xscale = FixedDiv(projection, tz);
+    yscale = FixedDiv(projectiony, tz);
 	
     gxt = -FixedMul(tr_x,viewsin); 
     gyt = FixedMul(tr_y,viewcos); 
@@ -541,7 +589,7 @@ void R_ProjectSprite (mobj_t* thing)
     // store information in a vissprite
     vis = R_NewVisSprite ();
     vis->mobjflags = thing->flags;
-    vis->scale = xscale<<detailshift;
+    vis->scale = yscale<<detailshift;
     vis->gx = thing->x;
     vis->gy = thing->y;
     vis->gz = thing->z;
@@ -550,6 +598,7 @@ void R_ProjectSprite (mobj_t* thing)
     vis->x1 = x1 < 0 ? 0 : x1;
     vis->x2 = x2 >= viewwidth ? viewwidth-1 : x2;	
     iscale = FixedDiv (FRACUNIT, xscale);
+    vis->yiscale = FixedDiv (FRACUNIT, yscale);
 
     if (flip)
     {
@@ -586,7 +635,7 @@ void R_ProjectSprite (mobj_t* thing)
     else
     {
 	// diminished light
-	index = xscale>>(LIGHTSCALESHIFT-detailshift);
+	index = yscale>>(LIGHTSCALESHIFT-detailshift);
 
 	if (index >= MAXLIGHTSCALE) 
 	    index = MAXLIGHTSCALE-1;
@@ -611,11 +660,11 @@ void R_AddSprites (sector_t* sec)
     // A sector might have been split into several
     //  subsectors during BSP building.
     // Thus we check whether its already added.
-    if (sec->validcount == validcount)
+    if (sectorframe[sec - sectors] == validcount)
 	return;		
 
     // Well, now it will be done.
-    sec->validcount = validcount;
+    sectorframe[sec - sectors] = validcount;
 	
     lightnum = (sec->lightlevel >> LIGHTSEGSHIFT)+extralight;
 
@@ -687,7 +736,8 @@ void R_DrawPSprite (pspdef_t* psp)
     vis->texturemid = (BASEYCENTER<<FRACBITS)+FRACUNIT/2-(psp->sy-spritetopoffset[lump]);
     vis->x1 = x1 < 0 ? 0 : x1;
     vis->x2 = x2 >= viewwidth ? viewwidth-1 : x2;	
-    vis->scale = pspritescale<<detailshift;
+    vis->scale = pspriteyscale<<detailshift;
+    vis->yiscale = pspriteyiscale;
     
     if (flip)
     {
@@ -772,98 +822,213 @@ void R_DrawPlayerSprites (void)
 
 //
 // R_SortVisSprites
+// Sorts by scale with qsort. Sprites of equal scale keep the order
+//  they were added in, as they did with the old selection sort.
 //
-vissprite_t	vsprsortedhead;
+R_THREADLOCAL vissprite_t	vsprsortedhead;
+
+static R_THREADLOCAL vissprite_t**	sortedsprites;
+static R_THREADLOCAL int		maxsortedsprites;
+
+static int R_CompareVisSprites (const void* a, const void* b)
+{
+    const vissprite_t*	va = *(vissprite_t* const*)a;
+    const vissprite_t*	vb = *(vissprite_t* const*)b;
 
+    if (va->scale != vb->scale)
+	return va->scale < vb->scale ? -1 : 1;
+    return va < vb ? -1 : va > vb;
+}
 
 void R_SortVisSprites (void)
 {
     int			i;
     int			count;
     vissprite_t*	ds;
-    vissprite_t*	best;
-    vissprite_t		unsorted;
-    fixed_t		bestscale;
 
     count = vissprite_p - vissprites;
 	
-    unsorted.next = unsorted.prev = &unsorted;
-
     if (!count)
 	return;
-		
-    for (ds=vissprites ; ds<vissprite_p ; ds++)
+
+    if (count > maxsortedsprites)
     {
-	ds->next = ds+1;
-	ds->prev = ds-1;
+	free(sortedsprites);
+	sortedsprites = malloc(maxvissprites * sizeof(*sortedsprites));
+	if (sortedsprites == NULL)
+	    I_Error ("R_SortVisSprites: out of memory");
+	maxsortedsprites = maxvissprites;
     }
-    
-    vissprites[0].prev = &unsorted;
-    unsorted.next = &vissprites[0];
-    (vissprite_p-1)->next = &unsorted;
-    unsorted.prev = vissprite_p-1;
-    
-    // pull the vissprites out by scale
 
+    for (i=0 ; i<count ; i++)
+	sortedsprites[i] = &vissprites[i];
+
+    qsort (sortedsprites, count, sizeof(*sortedsprites), R_CompareVisSprites);
+
+    // link them up smallest scale (farthest) first
     vsprsortedhead.next = vsprsortedhead.prev = &vsprsortedhead;
     for (i=0 ; i<count ; i++)
     {
-	bestscale = INT_MAX;
-        best = unsorted.next;
-	for (ds=unsorted.next ; ds!= &unsorted ; ds=ds->next)
-	{
-	    if (ds->scale < bestscale)
-	    {
-		bestscale = ds->scale;
-		best = ds;
-	    }
-	}
-	best->next->prev = best->prev;
-	best->prev->next = best->next;
-	best->next = &vsprsortedhead;
-	best->prev = vsprsortedhead.prev;
-	vsprsortedhead.prev->next = best;
-	vsprsortedhead.prev = best;
+	ds = sortedsprites[i];
+	ds->next = &vsprsortedhead;
+	ds->prev = vsprsortedhead.prev;
+	vsprsortedhead.prev->next = ds;
+	vsprsortedhead.prev = ds;
     }
 }
 
 
 
 //
-// R_DrawSprite
+// Drawseg index
+// The drawsegs that can clip sprites (those with a silhouette or
+//  masked texture) are bucketed by screen column once per frame, so
+//  each sprite only looks at the drawsegs near it. Buckets list their
+//  drawsegs in order, the same order the full scan visited them.
 //
-static short		clipbot[SCREENWIDTH];
-static short		cliptop[SCREENWIDTH];
-void R_DrawSprite (vissprite_t* spr)
+#define DSBUCKETSHIFT	4
+#define MAXDSBUCKETS	((MAXWIDTH >> DSBUCKETSHIFT) + 1)
+
+static R_THREADLOCAL int	dsbucketstart[MAXDSBUCKETS+1];
+static R_THREADLOCAL int	dsbucketfill[MAXDSBUCKETS];
+static R_THREADLOCAL int*	dsbucketsegs;
+static R_THREADLOCAL int*	dscandidates;
+static R_THREADLOCAL int	maxdsbucketsegs;
+
+static void R_IndexDrawSegs (void)
+{
+    drawseg_t*	ds;
+    int		numbuckets;
+    int		total;
+    int		b;
+
+    numbuckets = ((viewwidth-1) >> DSBUCKETSHIFT) + 1;
+    memset (dsbucketstart, 0, (numbuckets+1) * sizeof(*dsbucketstart));
+
+    for (ds=drawsegs ; ds<ds_p ; ds++)
+    {
+	if (!ds->silhouette && !ds->maskedtexturecol)
+	    continue;
+	for (b = ds->x1 >> DSBUCKETSHIFT ; b <= ds->x2 >> DSBUCKETSHIFT ; b++)
+	    dsbucketstart[b+1]++;
+    }
+
+    for (b=0 ; b<numbuckets ; b++)
+    {
+	dsbucketstart[b+1] += dsbucketstart[b];
+	dsbucketfill[b] = dsbucketstart[b];
+    }
+
+    total = dsbucketstart[numbuckets];
+    if (total > maxdsbucketsegs)
+    {
+	free(dsbucketsegs);
+	free(dscandidates);
+	dsbucketsegs = malloc(total * 2 * sizeof(*dsbucketsegs));
+	dscandidates = malloc(total * 2 * sizeof(*dscandidates));
+	if (dsbucketsegs == NULL || dscandidates == NULL)
+	    I_Error ("R_IndexDrawSegs: out of memory");
+	maxdsbucketsegs = total * 2;
+    }
+
+    for (ds=drawsegs ; ds<ds_p ; ds++)
+    {
+	if (!ds->silhouette && !ds->maskedtexturecol)
+	    continue;
+	for (b = ds->x1 >> DSBUCKETSHIFT ; b <= ds->x2 >> DSBUCKETSHIFT ; b++)
+	    dsbucketsegs[dsbucketfill[b]++] = ds - drawsegs;
+    }
+}
+
+static int R_CompareDrawSegIndex (const void* a, const void* b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+//
+// R_DrawSegsAt
+// Returns the indexed drawsegs overlapping columns x1 to x2, in
+//  order and without duplicates.
+//
+static int* R_DrawSegsAt (int x1, int x2, int* count)
+{
+    int		b1 = x1 >> DSBUCKETSHIFT;
+    int		b2 = x2 >> DSBUCKETSHIFT;
+    int		b;
+    int		i;
+    int		n;
+
+    if (b1 == b2)
+    {
+	*count = dsbucketstart[b1+1] - dsbucketstart[b1];
+	return dsbucketsegs + dsbucketstart[b1];
+    }
+
+    // A wide drawseg is in several buckets, so merge them.
+    n = dsbucketstart[b2+1] - dsbucketstart[b1];
+    memcpy (dscandidates, dsbucketsegs + dsbucketstart[b1],
+	    n * sizeof(*dscandidates));
+    qsort (dscandidates, n, sizeof(*dscandidates), R_CompareDrawSegIndex);
+
+    for (i = b = 0 ; i < n ; i++)
+	if (b == 0 || dscandidates[i] != dscandidates[b-1])
+	    dscandidates[b++] = dscandidates[i];
+
+    *count = b;
+    return dscandidates;
+}
+
+
+
+static R_THREADLOCAL short		clipbot[MAXWIDTH];
+static R_THREADLOCAL short		cliptop[MAXWIDTH];
+
+//
+// R_ClipSprite
+// Works out cliptop and clipbot for columns x1 to x2 of the
+//  sprite from the drawsegs in front of it. With drawmasked,
+//  the masked mid textures behind it are drawn on the way.
+//
+static void
+R_ClipSprite
+( vissprite_t*	spr,
+  int		x1,
+  int		x2,
+  boolean	drawmasked )
 {
     drawseg_t*		ds;
+    int*		segs;
+    int			numsegs;
+    int			i;
     int			x;
     int			r1;
     int			r2;
     fixed_t		scale;
     fixed_t		lowscale;
     int			silhouette;
-		
-    for (x = spr->x1 ; x<=spr->x2 ; x++)
+
+    for (x = x1 ; x<=x2 ; x++)
 	clipbot[x] = cliptop[x] = -2;
     
     // Scan drawsegs from end to start for obscuring segs.
     // The first drawseg that has a greater scale
     //  is the clip seg.
-    for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
+    segs = R_DrawSegsAt (x1, x2, &numsegs);
+    for (i=numsegs-1 ; i >= 0 ; i--)
     {
+	ds = drawsegs + segs[i];
+
 	// determine if the drawseg obscures the sprite
-	if (ds->x1 > spr->x2
-	    || ds->x2 < spr->x1
-	    || (!ds->silhouette
-		&& !ds->maskedtexturecol) )
+	// (the index only holds ones with a silhouette or masked texture)
+	if (ds->x1 > x2
+	    || ds->x2 < x1)
 	{
 	    // does not cover sprite
 	    continue;
 	}
 			
-	r1 = ds->x1 < spr->x1 ? spr->x1 : ds->x1;
-	r2 = ds->x2 > spr->x2 ? spr->x2 : ds->x2;
+	r1 = ds->x1 < x1 ? x1 : ds->x1;
+	r2 = ds->x2 > x2 ? x2 : ds->x2;
 
 	if (ds->scale1 > ds->scale2)
 	{
@@ -881,7 +1046,7 @@ void R_DrawSprite (vissprite_t* spr)
 		 && !R_PointOnSegSide (spr->gx, spr->gy, ds->curline) ) )
 	{
 	    // masked mid texture?
-	    if (ds->maskedtexturecol)	
+	    if (drawmasked && ds->maskedtexturecol)
 		R_RenderMaskedSegRange (ds, r1, r2);
 	    // seg is behind sprite
 	    continue;			
@@ -925,10 +1090,8 @@ void R_DrawSprite (vissprite_t* spr)
 		
     }
     
-    // all clipping has been performed, so draw the sprite
-
     // check for unclipped columns
-    for (x = spr->x1 ; x<=spr->x2 ; x++)
+    for (x = x1 ; x<=x2 ; x++)
     {
 	if (clipbot[x] == -2)		
 	    clipbot[x] = viewheight;
@@ -936,10 +1099,70 @@ void R_DrawSprite (vissprite_t* spr)
 	if (cliptop[x] == -2)
 	    cliptop[x] = -1;
     }
-		
+}
+
+
+//
+// R_ClipSpriteColumns
+// The same clipping for the single walk renderer, into top
+//  and bottom. Only this thread's strip is clipped, except for
+//  shadows which step through every column (see R_DrawVisSprite).
+//
+void
+R_ClipSpriteColumns
+( vissprite_t*	spr,
+  short*	top,
+  short*	bottom )
+{
+    int		x1;
+    int		x2;
+
+    x1 = spr->x1;
+    x2 = spr->x2;
+    if (spr->colormap)
+    {
+	if (x1 < r_stripx0)
+	    x1 = r_stripx0;
+	if (x2 >= r_stripx1)
+	    x2 = r_stripx1 - 1;
+	if (x1 > x2)
+	    return;
+    }
+
+    R_ClipSprite (spr, x1, x2, false);
+    memcpy (top + x1, cliptop + x1, (x2 - x1 + 1) * sizeof(*top));
+    memcpy (bottom + x1, clipbot + x1, (x2 - x1 + 1) * sizeof(*bottom));
+}
+
+
+//
+// R_DrawSprite
+//
+void R_DrawSprite (vissprite_t* spr)
+{
+    int			x1;
+    int			x2;
+
+    // Only this thread's strip needs clipping, except for
+    //  shadows which step through every column (see R_DrawVisSprite).
+    x1 = spr->x1;
+    x2 = spr->x2;
+    if (spr->colormap)
+    {
+	if (x1 < r_stripx0)
+	    x1 = r_stripx0;
+	if (x2 >= r_stripx1)
+	    x2 = r_stripx1 - 1;
+	if (x1 > x2)
+	    return;
+    }
+
+    R_ClipSprite (spr, x1, x2, true);
+
+    // all clipping has been performed, so draw the sprite
     mfloorclip = clipbot;
     mceilingclip = cliptop;
-    R_DrawVisSprite (spr, spr->x1, spr->x2);
+    R_DrawVisSprite (spr, x1, x2);
 }
 
 
@@ -955,6 +1178,13 @@ void R_DrawMasked (void)
 	
     R_SortVisSprites ();
 
+    if (vissprite_p > vissprites)
+	R_IndexDrawSegs ();
+
+    if (r_singlewalk)
+	R_WalkDrawMasked ();
+    else
+    {
     if (vissprite_p > vissprites)
     {
 	// draw all vissprites back to front
@@ -971,6 +1201,7 @@ void R_DrawMasked (void)
     for (ds=ds_p-1 ; ds >= drawsegs ; ds--)
 	if (ds->maskedtexturecol)
 	    R_RenderMaskedSegRange (ds, ds->x1, ds->x2);
+    }
     
     // draw the psprites on top of everything
     //  but does not draw on side views
@@ -22,29 +22,38 @@
 
 
 
+// Initial number of vissprites; more are added as needed.
 #define MAXVISSPRITES  	128
 
-extern vissprite_t	vissprites[MAXVISSPRITES];
-extern vissprite_t*	vissprite_p;
-extern vissprite_t	vsprsortedhead;
+extern R_THREADLOCAL vissprite_t*	vissprites;
+extern R_THREADLOCAL vissprite_t*	vissprite_p;
+extern R_THREADLOCAL vissprite_t	vsprsortedhead;
 
 // Constant arrays used for psprite clipping
 //  and initializing clipping.
-extern short		negonearray[SCREENWIDTH];
-extern short		screenheightarray[SCREENWIDTH];
+extern short		negonearray[MAXWIDTH];
+extern short		screenheightarray[MAXWIDTH];
 
 // vars for R_DrawMaskedColumn
-extern short*		mfloorclip;
-extern short*		mceilingclip;
-extern fixed_t		spryscale;
-extern fixed_t		sprtopscreen;
+extern R_THREADLOCAL short*		mfloorclip;
+extern R_THREADLOCAL short*		mceilingclip;
+extern R_THREADLOCAL fixed_t		spryscale;
+extern R_THREADLOCAL fixed_t		sprtopscreen;
 
 extern fixed_t		pspritescale;
 extern fixed_t		pspriteiscale;
+extern fixed_t		pspriteyscale;
+extern fixed_t		pspriteyiscale;
 
 
 void R_DrawMaskedColumn (column_t* column);
 
+void
+R_DrawVisSprite
+( vissprite_t*		vis,
+  int			x1,
+  int			x2 );
+
 
 void R_SortVisSprites (void);
 
@@ -61,5 +70,11 @@ R_ClipVisSprite
   int			xl,
   int			xh );
 
+void
+R_ClipSpriteColumns
+( vissprite_t*		vis,
+  short*		top,
+  short*		bottom );
+
 
 #endif
@@ -0,0 +1,320 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Single walk renderer.
+//	The usual renderer draws the walls while walking the BSP,
+//	 then the floors and ceilings gathered into visplanes, then
+//	 the sprites, each clipped by scanning the drawsegs.
+//	This one draws each subsector's floor and ceiling as soon
+//	 as its segs have marked them, so no visplanes are kept.
+//	Sprites are still clipped by scanning the drawsegs, the
+//	 same as the usual renderer, so that pass is no cheaper.
+//	 Each sprite is drawn with the subsector it stands in,
+//	 among the masked mid textures, back to front.
+//
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "i_system.h"
+
+#include "doomdef.h"
+#include "doomstat.h"
+
+#include "r_local.h"
+#include "r_sky.h"
+#include "r_walk.h"
+
+
+
+boolean			r_singlewalk = false;
+
+// The planes of the subsector being walked.
+static R_THREADLOCAL visplane_t	walkfloor;
+static R_THREADLOCAL visplane_t	walkceiling;
+static R_THREADLOCAL boolean	walkplanesready;
+
+// The frame each subsector was last walked in, and in what order.
+// Zero never matches validcount, which starts at 1.
+typedef struct
+{
+    int		frame;
+    int		walk;
+} subsectorwalk_t;
+
+static R_THREADLOCAL subsectorwalk_t*	subsectorwalks;
+static R_THREADLOCAL int		numsubsectorwalks;
+
+// The first drawseg of each subsector walked this frame.
+static R_THREADLOCAL int*	walkdrawsegs;
+static R_THREADLOCAL int	numwalks;
+static R_THREADLOCAL int	maxwalks;
+
+// A sprite and the subsector it's drawn with.
+typedef struct
+{
+    vissprite_t*	vis;
+    int			order;		// far to near
+    int			walk;
+    int			x1;
+    int			x2;
+    short*		topclip;
+    short*		bottomclip;
+} walkfragment_t;
+
+static R_THREADLOCAL walkfragment_t*	fragments;
+static R_THREADLOCAL int		numfragments;
+static R_THREADLOCAL int		maxfragments;
+
+
+//
+// R_ClearWalk
+// Called at frame start.
+//
+void R_ClearWalk (void)
+{
+    numwalks = 0;
+    numfragments = 0;
+
+    if (!walkplanesready)
+    {
+	memset (walkfloor.top, 0xff, sizeof(walkfloor.top));
+	memset (walkceiling.top, 0xff, sizeof(walkceiling.top));
+	walkfloor.minx = walkceiling.minx = SCREENWIDTH;
+	walkfloor.maxx = walkceiling.maxx = -1;
+	walkplanesready = true;
+    }
+
+    if (numsubsectorwalks < numsubsectors)
+    {
+	free(subsectorwalks);
+	subsectorwalks = calloc(numsubsectors, sizeof(*subsectorwalks));
+	if (subsectorwalks == NULL)
+	    I_Error ("R_ClearWalk: out of memory");
+	numsubsectorwalks = numsubsectors;
+    }
+}
+
+
+//
+// R_WalkPlane
+//
+static visplane_t*
+R_WalkPlane
+( visplane_t*	pl,
+  fixed_t	height,
+  int		picnum,
+  int		lightlevel )
+{
+    if (picnum == skyflatnum)
+    {
+	height = 0;
+	lightlevel = 0;
+    }
+
+    pl->height = height;
+    pl->picnum = picnum;
+    pl->lightlevel = lightlevel;
+
+    return pl;
+}
+
+
+//
+// R_WalkSubsector
+// Notes when the subsector was reached and gives its segs
+//  the planes to mark.
+//
+void R_WalkSubsector (int num)
+{
+    sector_t*	sec = subsectors[num].sector;
+
+    if (numwalks == maxwalks)
+    {
+	int	newmax = maxwalks ? maxwalks*2 : 256;
+	int*	newwalks;
+
+	newwalks = realloc(walkdrawsegs, newmax * sizeof(*walkdrawsegs));
+	if (newwalks == NULL)
+	    I_Error ("R_WalkSubsector: out of memory (%i subsectors)", newmax);
+	walkdrawsegs = newwalks;
+	maxwalks = newmax;
+    }
+
+    subsectorwalks[num].frame = validcount;
+    subsectorwalks[num].walk = numwalks;
+    walkdrawsegs[numwalks++] = ds_p - drawsegs;
+
+    if (sec->floorheight < viewz)
+    {
+	floorplane = R_WalkPlane (&walkfloor, sec->floorheight,
+				  sec->floorpic, sec->lightlevel);
+    }
+    else
+	floorplane = NULL;
+
+    if (sec->ceilingheight > viewz
+	|| sec->ceilingpic == skyflatnum)
+    {
+	ceilingplane = R_WalkPlane (&walkceiling, sec->ceilingheight,
+				    sec->ceilingpic, sec->lightlevel);
+    }
+    else
+	ceilingplane = NULL;
+}
+
+
+//
+// R_WalkFlushPlane
+//
+void R_WalkFlushPlane (visplane_t* pl)
+{
+    if (pl->minx <= pl->maxx)
+    {
+	R_DrawPlane (pl);
+	memset (pl->top + pl->minx, 0xff,
+		(pl->maxx - pl->minx + 1) * sizeof(*pl->top));
+    }
+
+    pl->minx = SCREENWIDTH;
+    pl->maxx = -1;
+}
+
+
+//
+// R_WalkDrawPlanes
+// Called once the subsector's segs are done. Nothing nearer
+//  can be left to draw over its floor and ceiling.
+//
+void R_WalkDrawPlanes (void)
+{
+    R_WalkFlushPlane (&walkfloor);
+    R_WalkFlushPlane (&walkceiling);
+}
+
+
+//
+// R_CutVisSprite
+// Adds the sprite as a fragment clipped by the drawsegs, as
+//  R_DrawSprite would. It's drawn with the subsector it stands
+//  in, or with the farthest one if that wasn't reached.
+//
+static void R_CutVisSprite (vissprite_t* vis, int order)
+{
+    walkfragment_t*	frag;
+    subsectorwalk_t*	ssw;
+
+    // Only shadows need drawing outside this thread's
+    //  strip (see R_DrawVisSprite.)
+    if (vis->colormap
+	&& (vis->x2 < r_stripx0 || vis->x1 >= r_stripx1))
+	return;
+
+    if (numfragments == maxfragments)
+    {
+	int			newmax = maxfragments ? maxfragments*2 : 128;
+	walkfragment_t*	newfrags;
+
+	newfrags = realloc(fragments, newmax * sizeof(*fragments));
+	if (newfrags == NULL)
+	    I_Error ("R_CutVisSprite: out of memory (%i fragments)", newmax);
+	fragments = newfrags;
+	maxfragments = newmax;
+    }
+
+    frag = &fragments[numfragments++];
+    frag->vis = vis;
+    frag->order = order;
+    frag->x1 = vis->x1;
+    frag->x2 = vis->x2;
+
+    ssw = &subsectorwalks[R_PointInSubsector (vis->gx, vis->gy) - subsectors];
+    frag->walk = ssw->frame == validcount ? ssw->walk : numwalks-1;
+    frag->topclip = R_NewOpenings (frag->x2 - frag->x1 + 1) - frag->x1;
+    frag->bottomclip = R_NewOpenings (frag->x2 - frag->x1 + 1) - frag->x1;
+    R_ClipSpriteColumns (vis, frag->topclip, frag->bottomclip);
+}
+
+
+static int R_CompareFragments (const void* a, const void* b)
+{
+    const walkfragment_t*	fa = a;
+    const walkfragment_t*	fb = b;
+
+    if (fa->walk != fb->walk)
+	return fa->walk < fb->walk ? -1 : 1;
+    if (fa->order != fb->order)
+	return fa->order < fb->order ? -1 : 1;
+    return fa->x1 - fb->x1;
+}
+
+
+//
+// R_WalkDrawMasked
+// The vissprites must be sorted.
+//
+void R_WalkDrawMasked (void)
+{
+    vissprite_t*	spr;
+    walkfragment_t*	frag;
+    drawseg_t*		ds;
+    drawseg_t*		end;
+    int			order;
+    int			walk;
+    int			first;
+    int			last;
+
+    // The sorted list is left over from the last frame
+    //  when there are no sprites.
+    order = 0;
+    if (vissprite_p > vissprites)
+    {
+	for (spr = vsprsortedhead.next ;
+	     spr != &vsprsortedhead ;
+	     spr = spr->next)
+	{
+	    R_CutVisSprite (spr, order++);
+	}
+    }
+
+    qsort (fragments, numfragments, sizeof(*fragments), R_CompareFragments);
+
+    // A subsector's masked mid textures are on its own segs,
+    //  so they're behind everything else in it.
+    last = numfragments;
+    end = ds_p;
+    for (walk = numwalks-1 ; walk >= 0 ; walk--)
+    {
+	for (ds = drawsegs + walkdrawsegs[walk] ; ds < end ; ds++)
+	    if (ds->maskedtexturecol)
+		R_RenderMaskedSegRange (ds, ds->x1, ds->x2);
+	end = drawsegs + walkdrawsegs[walk];
+
+	for (first = last ;
+	     first > 0 && fragments[first-1].walk == walk ;
+	     first--)
+	    ;
+
+	for (frag = &fragments[first] ; frag < &fragments[last] ; frag++)
+	{
+	    mfloorclip = frag->bottomclip;
+	    mceilingclip = frag->topclip;
+	    R_DrawVisSprite (frag->vis, frag->x1, frag->x2);
+	}
+	last = first;
+    }
+}
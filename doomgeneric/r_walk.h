@@ -0,0 +1,45 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Single walk renderer, drawing the view a subsector at a time.
+//
+
+
+#ifndef __R_WALK__
+#define __R_WALK__
+
+
+#include "r_defs.h"
+
+
+// Draw each subsector's floor and ceiling as it's walked
+//  instead of by visplane (see r_walk.c.)
+extern boolean		r_singlewalk;
+
+void R_ClearWalk (void);
+
+// Called for each subsector before and after its segs.
+void R_WalkSubsector (int num);
+void R_WalkDrawPlanes (void);
+
+// Draws what's marked in the plane and empties it.
+void R_WalkFlushPlane (visplane_t* pl);
+
+// Draws the sprites and masked mid textures back to front.
+void R_WalkDrawMasked (void);
+
+
+
+#endif
@@ -254,12 +254,14 @@
 #define ST_OUTHEIGHT		1
 
 #define ST_MAPTITLEX \
-    (SCREENWIDTH - ST_MAPWIDTH * ST_CHATFONTWIDTH)
+    (ORIGWIDTH - ST_MAPWIDTH * ST_CHATFONTWIDTH)
 
 #define ST_MAPTITLEY		0
 #define ST_MAPHEIGHT		1
 
-// graphics are drawn to a backing screen and blitted to the real screen
+// graphics are drawn to a backing screen and blitted to the real screen.
+// the backing screen is full size, with the status bar at the same
+// position as on the real screen, so both are scaled the same way.
 byte                   *st_backing_screen;
 	    
 // main player in game
@@ -420,14 +422,14 @@ void ST_refreshBackground(void)
     {
         V_UseBuffer(st_backing_screen);
 
-	V_DrawPatch(ST_X, 0, sbar);
+	V_DrawPatch(ST_X, ST_Y, sbar);
 
 	if (netgame)
-	    V_DrawPatch(ST_FX, 0, faceback);
+	    V_DrawPatch(ST_FX, ST_Y, faceback);
 
         V_RestoreBuffer();
 
-	V_CopyRect(ST_X, 0, st_backing_screen, ST_WIDTH, ST_HEIGHT, ST_X, ST_Y);
+	V_CopyRect(ST_X, ST_Y, st_backing_screen, ST_WIDTH, ST_HEIGHT, ST_X, ST_Y);
     }
 
 }
@@ -1411,6 +1413,6 @@ void ST_Stop (void)
 void ST_Init (void)
 {
     ST_loadData();
-    st_backing_screen = (byte *) Z_Malloc(ST_WIDTH * ST_HEIGHT, PU_STATIC, 0);
+    st_backing_screen = (byte *) Z_Malloc(SCREENWIDTH * SCREENHEIGHT, PU_STATIC, 0);
 }
 
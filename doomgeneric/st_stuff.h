@@ -25,11 +25,10 @@
 #include "d_event.h"
 #include "m_cheat.h"
 
-// Size of statusbar.
-// Now sensitive for scaling.
+// Size of statusbar, in the original 320x200 coordinates.
 #define ST_HEIGHT	32
-#define ST_WIDTH	SCREENWIDTH
-#define ST_Y		(SCREENHEIGHT - ST_HEIGHT)
+#define ST_WIDTH	ORIGWIDTH
+#define ST_Y		(ORIGHEIGHT - ST_HEIGHT)
 
 
 //
@@ -81,6 +81,10 @@ void V_MarkRect(int x, int y, int width, int height)
 
 //
 // V_CopyRect 
+// Coordinates are in the original 320x200 space and are scaled to the
+// screen. The source and destination are scaled the same way so they
+// should be at the same position in their buffers when the screen size
+// differs from the original.
 // 
 void V_CopyRect(int srcx, int srcy, byte *source,
                 int width, int height,
@@ -91,18 +95,25 @@ void V_CopyRect(int srcx, int srcy, byte *source,
  
 #ifdef RANGECHECK 
     if (srcx < 0
-     || srcx + width > SCREENWIDTH
+     || srcx + width > ORIGWIDTH
      || srcy < 0
-     || srcy + height > SCREENHEIGHT 
+     || srcy + height > ORIGHEIGHT 
      || destx < 0
-     || destx + width > SCREENWIDTH
+     || destx + width > ORIGWIDTH
      || desty < 0
-     || desty + height > SCREENHEIGHT)
+     || desty + height > ORIGHEIGHT)
     {
         I_Error ("Bad V_CopyRect");
     }
 #endif 
 
+    width = SCREENX(destx + width) - SCREENX(destx);
+    height = SCREENY(desty + height) - SCREENY(desty);
+    srcx = SCREENX(srcx);
+    srcy = SCREENY(srcy);
+    destx = SCREENX(destx);
+    desty = SCREENY(desty);
+
     V_MarkRect(destx, desty, width, height); 
  
     src = source + SCREENWIDTH * srcy + srcx; 
@@ -132,61 +143,52 @@ void V_SetPatchClipCallback(vpatchclipfunc_t func)
 }
 
 //
-// V_DrawPatch
-// Masks a column based masked pic to the screen. 
+// DrawScaledPatch
+// Draws a patch at x, y in the original 320x200 space, scaling it to
+// the screen by selecting the nearest pixel. At the original screen size
+// this maps every pixel to itself.
 //
 
-void V_DrawPatch(int x, int y, patch_t *patch)
-{ 
-    int count;
-    int col;
+static void DrawScaledPatch(int x, int y, patch_t *patch, boolean flipped)
+{
     column_t *column;
     byte *desttop;
     byte *dest;
     byte *source;
     int w;
+    int dx, dx1;
+    int dy, dy1;
+    int top;
 
-    y -= SHORT(patch->topoffset);
-    x -= SHORT(patch->leftoffset);
+    w = SHORT(patch->width);
+    dx = SCREENX(x);
+    dx1 = SCREENX(x + w);
 
-    // haleyjd 08/28/10: Strife needs silent error checking here.
-    if(patchclip_callback)
-    {
-        if(!patchclip_callback(patch, x, y))
-            return;
-    }
+    V_MarkRect(dx, SCREENY(y), dx1 - dx, SCREENY(y + SHORT(patch->height)) - SCREENY(y));
 
-#ifdef RANGECHECK
-    if (x < 0
-     || x + SHORT(patch->width) > SCREENWIDTH
-     || y < 0
-     || y + SHORT(patch->height) > SCREENHEIGHT)
-    {
-        I_Error("Bad V_DrawPatch x=%i y=%i patch.width=%i patch.height=%i topoffset=%i leftoffset=%i", x, y, patch->width, patch->height, patch->topoffset, patch->leftoffset);
-    }
-#endif
+    desttop = dest_screen + dx;
 
-    V_MarkRect(x, y, SHORT(patch->width), SHORT(patch->height));
+    for ( ; dx<dx1 ; dx++, desttop++)
+    {
+        int col = dx * ORIGWIDTH / SCREENWIDTH - x;
 
-    col = 0;
-    desttop = dest_screen + y * SCREENWIDTH + x;
+        if (flipped)
+            col = w - 1 - col;
 
-    w = SHORT(patch->width);
-
-    for ( ; col<w ; x++, col++, desttop++)
-    {
         column = (column_t *)((byte *)patch + LONG(patch->columnofs[col]));
 
         // step through the posts in a column
         while (column->topdelta != 0xff)
         {
             source = (byte *)column + 3;
-            dest = desttop + column->topdelta*SCREENWIDTH;
-            count = column->length;
+            top = y + column->topdelta;
+            dy = SCREENY(top);
+            dy1 = SCREENY(top + column->length);
+            dest = desttop + dy*SCREENWIDTH;
 
-            while (count--)
+            for ( ; dy<dy1 ; dy++)
             {
-                *dest = *source++;
+                *dest = source[dy * ORIGHEIGHT / SCREENHEIGHT - top];
                 dest += SCREENWIDTH;
             }
             column = (column_t *)((byte *)column + column->length + 4);
@@ -194,6 +196,36 @@ void V_DrawPatch(int x, int y, patch_t *patch)
     }
 }
 
+//
+// V_DrawPatch
+// Masks a column based masked pic to the screen. 
+//
+
+void V_DrawPatch(int x, int y, patch_t *patch)
+{ 
+    y -= SHORT(patch->topoffset);
+    x -= SHORT(patch->leftoffset);
+
+    // haleyjd 08/28/10: Strife needs silent error checking here.
+    if(patchclip_callback)
+    {
+        if(!patchclip_callback(patch, x, y))
+            return;
+    }
+
+#ifdef RANGECHECK
+    if (x < 0
+     || x + SHORT(patch->width) > ORIGWIDTH
+     || y < 0
+     || y + SHORT(patch->height) > ORIGHEIGHT)
+    {
+        I_Error("Bad V_DrawPatch x=%i y=%i patch.width=%i patch.height=%i topoffset=%i leftoffset=%i", x, y, patch->width, patch->height, patch->topoffset, patch->leftoffset);
+    }
+#endif
+
+    DrawScaledPatch(x, y, patch, false);
+}
+
 //
 // V_DrawPatchFlipped
 // Masks a column based masked pic to the screen.
@@ -202,14 +234,6 @@ void V_DrawPatch(int x, int y, patch_t *patch)
 
 void V_DrawPatchFlipped(int x, int y, patch_t *patch)
 {
-    int count;
-    int col; 
-    column_t *column; 
-    byte *desttop;
-    byte *dest;
-    byte *source; 
-    int w; 
- 
     y -= SHORT(patch->topoffset); 
     x -= SHORT(patch->leftoffset); 
 
@@ -222,40 +246,15 @@ void V_DrawPatchFlipped(int x, int y, patch_t *patch)
 
 #ifdef RANGECHECK 
     if (x < 0
-     || x + SHORT(patch->width) > SCREENWIDTH
+     || x + SHORT(patch->width) > ORIGWIDTH
      || y < 0
-     || y + SHORT(patch->height) > SCREENHEIGHT)
+     || y + SHORT(patch->height) > ORIGHEIGHT)
     {
         I_Error("Bad V_DrawPatchFlipped");
     }
 #endif
 
-    V_MarkRect (x, y, SHORT(patch->width), SHORT(patch->height));
-
-    col = 0;
-    desttop = dest_screen + y * SCREENWIDTH + x;
-
-    w = SHORT(patch->width);
-
-    for ( ; col<w ; x++, col++, desttop++)
-    {
-        column = (column_t *)((byte *)patch + LONG(patch->columnofs[w-1-col]));
-
-        // step through the posts in a column
-        while (column->topdelta != 0xff )
-        {
-            source = (byte *)column + 3;
-            dest = desttop + column->topdelta*SCREENWIDTH;
-            count = column->length;
-
-            while (count--)
-            {
-                *dest = *source++;
-                dest += SCREENWIDTH;
-            }
-            column = (column_t *)((byte *)column + column->length + 4);
-        }
-    }
+    DrawScaledPatch(x, y, patch, true);
 }
 
 
@@ -56,11 +56,12 @@ wad_file_t *W_OpenFile(char *path)
     int i;
 
     //!
-    // Use the OS's virtual memory subsystem to map WAD files
-    // directly into memory.
+    // Read WAD files with stdio instead of using the OS's virtual
+    // memory subsystem to map them directly into memory.  (Mapping
+    // is the default where it's available.)
     //
 
-    if (!M_CheckParm("-mmap"))
+    if (M_CheckParm("-nommap"))
     {
         return stdc_wad_file.OpenFile(path);
     }
@@ -93,3 +94,11 @@ size_t W_Read(wad_file_t *wad, unsigned int offset,
     return wad->file_class->Read(wad, offset, buffer, buffer_len);
 }
 
+void W_Prefetch(wad_file_t *wad, unsigned int offset, size_t len)
+{
+    if (wad->file_class->Prefetch != NULL)
+    {
+        wad->file_class->Prefetch(wad, offset, len);
+    }
+}
+
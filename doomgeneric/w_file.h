@@ -41,6 +41,11 @@ typedef struct
     size_t (*Read)(wad_file_t *file, unsigned int offset,
                    void *buffer, size_t buffer_len);
 
+    // Hint that the given range of the file will be needed soon.
+    // May be NULL if the class can't do anything useful with it.
+
+    void (*Prefetch)(wad_file_t *file, unsigned int offset, size_t len);
+
 } wad_file_class_t;
 
 struct _wad_file_s
@@ -75,4 +80,8 @@ void W_CloseFile(wad_file_t *wad);
 size_t W_Read(wad_file_t *wad, unsigned int offset,
               void *buffer, size_t buffer_len);
 
+// Hint that the given range of the file will be read soon.
+
+void W_Prefetch(wad_file_t *wad, unsigned int offset, size_t len);
+
 #endif /* #ifndef __W_FILE__ */
@@ -0,0 +1,246 @@
+//
+// Copyright(C) 1993-1996 Id Software, Inc.
+// Copyright(C) 2005-2014 Simon Howard
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	WAD I/O functions.
+//
+
+#include "config.h"
+
+#ifdef HAVE_MMAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "w_file.h"
+#include "z_zone.h"
+
+typedef struct
+{
+    wad_file_t wad;
+    int handle;
+} posix_wad_file_t;
+
+extern wad_file_class_t posix_wad_file;
+
+static void MapFile(posix_wad_file_t *wad, char *filename)
+{
+    void *result;
+    int protection;
+    int flags;
+
+    // An empty file can't be mapped; it'll be read instead.
+
+    if (wad->wad.length == 0)
+    {
+        return;
+    }
+
+    // Mapped area can be read and written to.  Ideally
+    // this should be read-only, as none of the Doom code should
+    // change the WAD files after being read.  However, there may
+    // be code lurking in the source that does.
+
+    protection = PROT_READ|PROT_WRITE;
+
+    // Writes to the mapped area result in private changes that are
+    // *not* written to disk.  Pages that are never written are
+    // shared with the page cache, and so with any other process
+    // that has the same file mapped.
+
+    flags = MAP_PRIVATE;
+
+    result = mmap(NULL, wad->wad.length,
+                  protection, flags,
+                  wad->handle, 0);
+
+    if (result == MAP_FAILED)
+    {
+        fprintf(stderr, "W_Posix_OpenFile: Unable to mmap() %s - %s\n",
+                        filename, strerror(errno));
+        return;
+    }
+
+    wad->wad.mapped = result;
+}
+
+static unsigned int GetFileLength(int handle)
+{
+    struct stat st;
+
+    if (fstat(handle, &st) < 0)
+    {
+        return 0;
+    }
+
+    return st.st_size;
+}
+
+static wad_file_t *W_Posix_OpenFile(char *path)
+{
+    posix_wad_file_t *result;
+    int handle;
+
+    handle = open(path, O_RDONLY);
+
+    if (handle < 0)
+    {
+        return NULL;
+    }
+
+    // Create a new posix_wad_file_t to hold the file handle.
+
+    result = Z_Malloc(sizeof(posix_wad_file_t), PU_STATIC, 0);
+    result->wad.file_class = &posix_wad_file;
+    result->wad.mapped = NULL;
+    result->wad.length = GetFileLength(handle);
+    result->handle = handle;
+
+    // Try to map the file into memory with mmap:
+
+    MapFile(result, path);
+
+    return &result->wad;
+}
+
+static void W_Posix_CloseFile(wad_file_t *wad)
+{
+    posix_wad_file_t *posix_wad;
+
+    posix_wad = (posix_wad_file_t *) wad;
+
+    // If mapped, unmap it.
+
+    if (posix_wad->wad.mapped != NULL)
+    {
+        munmap(posix_wad->wad.mapped, posix_wad->wad.length);
+    }
+
+    close(posix_wad->handle);
+    Z_Free(posix_wad);
+}
+
+// Read data from the specified position in the file into the
+// provided buffer.  Returns the number of bytes read.
+
+static size_t W_Posix_Read(wad_file_t *wad, unsigned int offset,
+                           void *buffer, size_t buffer_len)
+{
+    posix_wad_file_t *posix_wad;
+    byte *byte_buffer;
+    size_t bytes_read;
+    ssize_t result;
+
+    posix_wad = (posix_wad_file_t *) wad;
+
+    // Straight out of the mapping if we have one.
+
+    if (posix_wad->wad.mapped != NULL)
+    {
+        if (offset >= posix_wad->wad.length)
+        {
+            return 0;
+        }
+
+        if (buffer_len > posix_wad->wad.length - offset)
+        {
+            buffer_len = posix_wad->wad.length - offset;
+        }
+
+        memcpy(buffer, posix_wad->wad.mapped + offset, buffer_len);
+
+        return buffer_len;
+    }
+
+    // Jump to the specified position in the file.
+
+    lseek(posix_wad->handle, offset, SEEK_SET);
+
+    // Read into the buffer.
+
+    bytes_read = 0;
+    byte_buffer = buffer;
+
+    while (buffer_len > 0) {
+        result = read(posix_wad->handle, byte_buffer, buffer_len);
+
+        if (result < 0) {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("W_Posix_Read");
+            break;
+        } else if (result == 0) {
+            break;
+        }
+
+        // Successfully read some bytes
+
+        byte_buffer += result;
+        buffer_len -= result;
+        bytes_read += result;
+    }
+
+    return bytes_read;
+}
+
+// Ask the kernel to start reading in the given range of the
+// mapping so it's in the page cache by the time we get to it.
+
+static void W_Posix_Prefetch(wad_file_t *wad, unsigned int offset,
+                             size_t len)
+{
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t pagesize;
+
+    if (wad->mapped == NULL || offset >= wad->length)
+    {
+        return;
+    }
+
+    if (len > wad->length - offset)
+    {
+        len = wad->length - offset;
+    }
+
+    // madvise() wants a page aligned address.
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    start = (uintptr_t) (wad->mapped + offset) & ~(pagesize - 1);
+    end = (uintptr_t) (wad->mapped + offset + len);
+
+    madvise((void *) start, end - start, MADV_WILLNEED);
+}
+
+
+wad_file_class_t posix_wad_file =
+{
+    W_Posix_OpenFile,
+    W_Posix_CloseFile,
+    W_Posix_Read,
+    W_Posix_Prefetch,
+};
+
+
+#endif /* #ifdef HAVE_MMAP */
+
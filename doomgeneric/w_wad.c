@@ -60,29 +60,48 @@ typedef struct
 
 lumpinfo_t *lumpinfo;		
 unsigned int numlumps = 0;
+unsigned int lumprereadbytes = 0;
 
 // Hash table for fast lookups
 
 static lumpinfo_t **lumphash;
 
-// Hash function used for lump names.
+// Lump names (and texture, flat and sprite names, which are all
+// lump-style names) are looked up by key: the name in upper case,
+// packed one character to a byte into 64 bits, so that comparing
+// two names is comparing two integers.  It's the same whatever the
+// byte order, since the first character is always the low byte.
 
-unsigned int W_LumpNameHash(const char *s)
+uint64_t W_LumpNameKey(const char *s)
 {
-    // This is the djb2 string hash function, modded to work on strings
-    // that have a maximum length of 8.
-
-    unsigned int result = 5381;
+    uint64_t result = 0;
     unsigned int i;
 
     for (i=0; i < 8 && s[i] != '\0'; ++i)
     {
-        result = ((result << 5) ^ result ) ^ toupper((int)s[i]);
+        result |= (uint64_t) (toupper((int)s[i]) & 0xff) << (i * 8);
     }
 
     return result;
 }
 
+// Hash function used for keys.
+
+unsigned int W_LumpKeyHash(uint64_t key)
+{
+    // Fibonacci hashing: multiply by 2^64 / phi and keep the top
+    // bits, which depend on every character of the name.
+
+    return (unsigned int) ((key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// Hash function used for lump names.
+
+unsigned int W_LumpNameHash(const char *s)
+{
+    return W_LumpKeyHash(W_LumpNameKey(s));
+}
+
 // Increase the size of the lumpinfo[] array to the specified size.
 static void ExtendLumpInfo(int newnumlumps)
 {
@@ -220,6 +239,7 @@ wad_file_t *W_AddFile (char *filename)
 		lump_p->size = LONG(filerover->size);
 			lump_p->cache = NULL;
 		strncpy(lump_p->name, filerover->name, 8);
+		lump_p->key = W_LumpNameKey(lump_p->name);
 
 			++lump_p;
 			++filerover;
@@ -256,8 +276,11 @@ int W_NumLumps (void)
 int W_CheckNumForName (char* name)
 {
     lumpinfo_t *lump_p;
+    uint64_t key;
     int i;
 
+    key = W_LumpNameKey(name);
+
     // Do we have a hash table yet?
 
     if (lumphash != NULL)
@@ -266,11 +289,11 @@ int W_CheckNumForName (char* name)
         
         // We do! Excellent.
 
-        hash = W_LumpNameHash(name) % numlumps;
+        hash = W_LumpKeyHash(key) % numlumps;
         
         for (lump_p = lumphash[hash]; lump_p != NULL; lump_p = lump_p->next)
         {
-            if (!strncasecmp(lump_p->name, name, 8))
+            if (lump_p->key == key)
             {
                 return lump_p - lumpinfo;
             }
@@ -284,7 +307,7 @@ int W_CheckNumForName (char* name)
 
         for (i=numlumps-1; i >= 0; --i)
         {
-            if (!strncasecmp(lumpinfo[i].name, name, 8))
+            if (lumpinfo[i].key == key)
             {
                 return i;
             }
@@ -413,6 +436,12 @@ void *W_CacheLumpNum(int lumpnum, int tag)
     {
         // Not yet loaded, so load it now
 
+        if (lump->wascached)
+        {
+            lumprereadbytes += lump->size;
+        }
+        lump->wascached = true;
+
         lump->cache = Z_Malloc(W_LumpLength(lumpnum), tag, &lump->cache);
 	W_ReadLump (lumpnum, lump->cache);
         result = lump->cache;
@@ -467,6 +496,48 @@ void W_ReleaseLumpName(char *name)
     W_ReleaseLumpNum(W_GetNumForName(name));
 }
 
+//
+// W_PrefetchLumps
+//
+// Hint that a run of lumps (e.g. a level) is about to be loaded, so
+// a memory-mapped file can start paging them in all at once rather
+// than faulting them in one by one.  Lumps in a run are normally next
+// to each other in the same file.
+//
+
+void W_PrefetchLumps(int lumpnum, int count)
+{
+    lumpinfo_t *first;
+    lumpinfo_t *lump;
+    int end;
+    int i;
+
+    if (lumpnum < 0 || count <= 0 || lumpnum + count > numlumps)
+    {
+        return;
+    }
+
+    first = &lumpinfo[lumpnum];
+    end = first->position + first->size;
+
+    for (i = 1; i < count; ++i)
+    {
+        lump = &lumpinfo[lumpnum + i];
+
+        if (lump->wad_file != first->wad_file || lump->position < first->position)
+        {
+            break;
+        }
+
+        if (lump->position + lump->size > end)
+        {
+            end = lump->position + lump->size;
+        }
+    }
+
+    W_Prefetch(first->wad_file, first->position, end - first->position);
+}
+
 #if 0
 
 //
@@ -557,7 +628,7 @@ void W_GenerateHashTable(void)
         {
             unsigned int hash;
 
-            hash = W_LumpNameHash(lumpinfo[i].name) % numlumps;
+            hash = W_LumpKeyHash(lumpinfo[i].key) % numlumps;
 
             // Hook into the hash table
 
@@ -41,10 +41,12 @@ typedef struct lumpinfo_s lumpinfo_t;
 struct lumpinfo_s
 {
     char	name[8];
+    uint64_t	key;		// W_LumpNameKey(name)
     wad_file_t *wad_file;
     int		position;
     int		size;
     void       *cache;
+    boolean	wascached;	// cache has been loaded before
 
     // Used for hash table lookups
 
@@ -55,6 +57,9 @@ struct lumpinfo_s
 extern lumpinfo_t *lumpinfo;
 extern unsigned int numlumps;
 
+// Bytes read again for lumps that had been purged from the cache.
+extern unsigned int lumprereadbytes;
+
 wad_file_t *W_AddFile (char *filename);
 
 int	W_CheckNumForName (char* name);
@@ -69,10 +74,14 @@ void*	W_CacheLumpName (char* name, int tag);
 void    W_GenerateHashTable(void);
 
 extern unsigned int W_LumpNameHash(const char *s);
+extern uint64_t W_LumpNameKey(const char *s);
+extern unsigned int W_LumpKeyHash(uint64_t key);
 
 void    W_ReleaseLumpNum(int lump);
 void    W_ReleaseLumpName(char *name);
 
+void    W_PrefetchLumps(int lump, int count);
+
 void W_CheckCorrectIWAD(GameMission_t mission);
 
 #endif
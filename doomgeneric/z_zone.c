@@ -17,6 +17,9 @@
 //
 
 
+#include <string.h>
+#include <time.h>
+
 #include "z_zone.h"
 #include "i_system.h"
 #include "doomtype.h"
@@ -27,7 +30,19 @@
 //
 // There is never any space between memblocks,
 //  and there will never be two contiguous free memblocks.
-// The rover can be left pointing at a non-empty block.
+//
+// Free blocks are kept in segregated lists by size, so
+//  finding one that fits takes a couple of bit scans
+//  instead of a walk around the zone. Each size class is
+//  split into a few linear steps (a two level "TLSF"
+//  style index) so blocks in a list are within 25% of
+//  each other in size.
+//
+// Purgable blocks (tags >= PU_PURGELEVEL) are kept in a
+//  least recently used list. A block moves to the back
+//  of it whenever its tag is set to a purgable tag again,
+//  which is how W_CacheLumpNum marks a cached lump as used.
+//  When nothing fits, blocks are purged from the front.
 //
 // It is of no value to free a cachable block,
 //  because it will get overwritten automatically if needed.
@@ -44,9 +59,18 @@ typedef struct memblock_s
     int			id;	// should be ZONEID
     struct memblock_s*	next;
     struct memblock_s*	prev;
+
+    // free list if free, cache list if purgable
+    struct memblock_s*	lnext;
+    struct memblock_s*	lprev;
 } memblock_t;
 
 
+// Each power of two size class is split into 1<<SUBBITS lists.
+#define SUBBITS		2
+#define NUMSUBS		(1 << SUBBITS)
+#define NUMCLASSES	32
+
 typedef struct
 {
     // total bytes malloced, including header
@@ -54,8 +78,17 @@ typedef struct
 
     // start / end cap for linked list
     memblock_t	blocklist;
-    
-    memblock_t*	rover;
+
+    // free blocks by size, with a bit set for each
+    //  list that isn't empty
+    memblock_t*	freelists[NUMCLASSES][NUMSUBS];
+    unsigned int	classmap;
+    unsigned int	submap[NUMCLASSES];
+
+    // purgable blocks, least recently used first
+    memblock_t	cachelist;
+
+    zonestats_t	stats;
     
 } memzone_t;
 
@@ -63,6 +96,152 @@ typedef struct
 
 memzone_t*	mainzone;
 
+int		z_timemallocs;
+
+
+// Index of the lowest or highest set bit. There must be one.
+static int Z_LowBit (unsigned int bits)
+{
+    int		i;
+
+    for (i=0 ; !(bits & 1) ; i++)
+	bits >>= 1;
+    return i;
+}
+
+static int Z_HighBit (unsigned int bits)
+{
+    int		i;
+
+    for (i=0 ; bits > 1 ; i++)
+	bits >>= 1;
+    return i;
+}
+
+// The list a free block of the given size belongs in.
+static void Z_SizeList (int size, int* sizeclass, int* sub)
+{
+    *sizeclass = Z_HighBit (size);
+    *sub = (size >> (*sizeclass - SUBBITS)) & (NUMSUBS - 1);
+}
+
+static void Z_InsertFree (memzone_t* zone, memblock_t* block)
+{
+    int		sizeclass;
+    int		sub;
+
+    Z_SizeList (block->size, &sizeclass, &sub);
+
+    block->lprev = NULL;
+    block->lnext = zone->freelists[sizeclass][sub];
+    if (block->lnext)
+	block->lnext->lprev = block;
+    zone->freelists[sizeclass][sub] = block;
+
+    zone->classmap |= 1u << sizeclass;
+    zone->submap[sizeclass] |= 1u << sub;
+
+    zone->stats.blocks[PU_FREE]++;
+    zone->stats.bytes[PU_FREE] += block->size;
+}
+
+static void Z_RemoveFree (memzone_t* zone, memblock_t* block)
+{
+    int		sizeclass;
+    int		sub;
+
+    Z_SizeList (block->size, &sizeclass, &sub);
+
+    if (block->lprev)
+	block->lprev->lnext = block->lnext;
+    else
+	zone->freelists[sizeclass][sub] = block->lnext;
+    if (block->lnext)
+	block->lnext->lprev = block->lprev;
+
+    if (!zone->freelists[sizeclass][sub])
+    {
+	zone->submap[sizeclass] &= ~(1u << sub);
+	if (!zone->submap[sizeclass])
+	    zone->classmap &= ~(1u << sizeclass);
+    }
+
+    zone->stats.blocks[PU_FREE]--;
+    zone->stats.bytes[PU_FREE] -= block->size;
+}
+
+//
+// Z_FindFree
+// Returns a free block of at least the given size, or NULL.
+// The size is rounded up to the next list so that any block
+//  in the list found is big enough.
+//
+static memblock_t* Z_FindFree (memzone_t* zone, int size)
+{
+    int			sizeclass;
+    int			sub;
+    unsigned int	bits;
+    memblock_t*		block;
+
+    Z_SizeList (size, &sizeclass, &sub);
+
+    // a list that might hold blocks that are too small
+    if (size & ((1 << (sizeclass - SUBBITS)) - 1))
+    {
+	if (++sub == NUMSUBS)
+	{
+	    sub = 0;
+	    sizeclass++;
+	}
+    }
+
+    bits = sizeclass < NUMCLASSES
+	 ? zone->submap[sizeclass] & (~0u << sub) : 0;
+
+    if (!bits)
+    {
+	bits = sizeclass + 1 < NUMCLASSES
+	     ? zone->classmap & (~0u << (sizeclass + 1)) : 0;
+
+	if (!bits)
+	{
+	    // Nothing is sure to fit, but there might be a block
+	    //  in the list below that's just big enough.
+	    Z_SizeList (size, &sizeclass, &sub);
+
+	    for (block = zone->freelists[sizeclass][sub] ;
+		 block != NULL ;
+		 block = block->lnext)
+	    {
+		if (block->size >= size)
+		    return block;
+	    }
+	    return NULL;
+	}
+
+	sizeclass = Z_LowBit (bits);
+	bits = zone->submap[sizeclass];
+    }
+
+    sub = Z_LowBit (bits);
+    return zone->freelists[sizeclass][sub];
+}
+
+// The cache list is circular around zone->cachelist.
+static void Z_LinkCache (memzone_t* zone, memblock_t* block)
+{
+    block->lnext = &zone->cachelist;
+    block->lprev = zone->cachelist.lprev;
+    block->lprev->lnext = block;
+    zone->cachelist.lprev = block;
+}
+
+static void Z_UnlinkCache (memblock_t* block)
+{
+    block->lprev->lnext = block->lnext;
+    block->lnext->lprev = block->lprev;
+}
+
 
 
 //
@@ -72,6 +251,13 @@ void Z_ClearZone (memzone_t* zone)
 {
     memblock_t*		block;
 	
+    memset (&zone->stats, 0, sizeof(zone->stats));
+    memset (zone->freelists, 0, sizeof(zone->freelists));
+    memset (zone->submap, 0, sizeof(zone->submap));
+    zone->classmap = 0;
+
+    zone->cachelist.lnext = zone->cachelist.lprev = &zone->cachelist;
+
     // set the entire zone to one free block
     zone->blocklist.next =
 	zone->blocklist.prev =
@@ -79,7 +265,6 @@ void Z_ClearZone (memzone_t* zone)
     
     zone->blocklist.user = (void *)zone;
     zone->blocklist.tag = PU_STATIC;
-    zone->rover = block;
 	
     block->prev = block->next = &zone->blocklist;
     
@@ -87,6 +272,8 @@ void Z_ClearZone (memzone_t* zone)
     block->tag = PU_FREE;
 
     block->size = zone->size - sizeof(memzone_t);
+
+    Z_InsertFree (zone, block);
 }
 
 
@@ -96,27 +283,12 @@ void Z_ClearZone (memzone_t* zone)
 //
 void Z_Init (void)
 {
-    memblock_t*	block;
     int		size;
 
     mainzone = (memzone_t *)I_ZoneBase (&size);
     mainzone->size = size;
 
-    // set the entire zone to one free block
-    mainzone->blocklist.next =
-	mainzone->blocklist.prev =
-	block = (memblock_t *)( (byte *)mainzone + sizeof(memzone_t) );
-
-    mainzone->blocklist.user = (void *)mainzone;
-    mainzone->blocklist.tag = PU_STATIC;
-    mainzone->rover = block;
-	
-    block->prev = block->next = &mainzone->blocklist;
-
-    // free block
-    block->tag = PU_FREE;
-    
-    block->size = mainzone->size - sizeof(memzone_t);
+    Z_ClearZone (mainzone);
 }
 
 
@@ -139,6 +311,12 @@ void Z_Free (void* ptr)
 	    *block->user = 0;
     }
 
+    if (block->tag >= PU_PURGELEVEL)
+	Z_UnlinkCache (block);
+
+    mainzone->stats.blocks[block->tag]--;
+    mainzone->stats.bytes[block->tag] -= block->size;
+
     // mark as free
     block->tag = PU_FREE;
     block->user = NULL;
@@ -149,13 +327,11 @@ void Z_Free (void* ptr)
     if (other->tag == PU_FREE)
     {
         // merge with previous free block
+	Z_RemoveFree (mainzone, other);
         other->size += block->size;
         other->next = block->next;
         other->next->prev = other;
 
-        if (block == mainzone->rover)
-            mainzone->rover = other;
-
         block = other;
     }
 	
@@ -163,13 +339,13 @@ void Z_Free (void* ptr)
     if (other->tag == PU_FREE)
     {
         // merge the next free block onto the end
+	Z_RemoveFree (mainzone, other);
         block->size += other->size;
         block->next = other->next;
         block->next->prev = block;
-
-        if (other == mainzone->rover)
-            mainzone->rover = block;
     }
+
+    Z_InsertFree (mainzone, block);
 }
 
 
@@ -188,66 +364,37 @@ Z_Malloc
   void*		user )
 {
     int		extra;
-    memblock_t*	start;
-    memblock_t* rover;
     memblock_t* newblock;
     memblock_t*	base;
     void *result;
+#ifdef CLOCK_MONOTONIC
+    struct timespec	start;
+
+    if (z_timemallocs)
+	clock_gettime (CLOCK_MONOTONIC, &start);
+#endif
 
     size = (size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1);
     
-    // scan through the block list,
-    // looking for the first free block
-    // of sufficient size,
-    // throwing out any purgable blocks along the way.
-
     // account for size of block header
     size += sizeof(memblock_t);
     
-    // if there is a free block behind the rover,
-    //  back up over them
-    base = mainzone->rover;
-    
-    if (base->prev->tag == PU_FREE)
-        base = base->prev;
-	
-    rover = base;
-    start = base->prev;
-	
-    do
+    // find a free block big enough, purging the least
+    // recently used cachable blocks until there is one
+    while ((base = Z_FindFree (mainzone, size)) == NULL)
     {
-        if (rover == start)
-        {
-            // scanned all the way around the list
-            I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
-        }
-	
-        if (rover->tag != PU_FREE)
-        {
-            if (rover->tag < PU_PURGELEVEL)
-            {
-                // hit a block that can't be purged,
-                // so move base past it
-                base = rover = rover->next;
-            }
-            else
-            {
-                // free the rover block (adding the size to base)
-
-                // the rover can be the base block
-                base = base->prev;
-                Z_Free ((byte *)rover+sizeof(memblock_t));
-                base = base->next;
-                rover = base->next;
-            }
-        }
-        else
-        {
-            rover = rover->next;
-        }
+	if (mainzone->cachelist.lnext == &mainzone->cachelist)
+	{
+	    // nothing left to purge
+	    I_Error ("Z_Malloc: failed on allocation of %i bytes", size);
+	}
 
-    } while (base->tag != PU_FREE || base->size < size);
+	mainzone->stats.purges++;
+	mainzone->stats.purgedbytes += mainzone->cachelist.lnext->size;
+	Z_Free ((byte *)mainzone->cachelist.lnext + sizeof(memblock_t));
+    }
 
+    Z_RemoveFree (mainzone, base);
     
     // found a block big enough
     extra = base->size - size;
@@ -266,6 +413,8 @@ Z_Malloc
 
         base->next = newblock;
         base->size = size;
+
+	Z_InsertFree (mainzone, newblock);
     }
 	
 	if (user == NULL && tag >= PU_PURGELEVEL)
@@ -274,6 +423,12 @@ Z_Malloc
     base->user = user;
     base->tag = tag;
 
+    if (tag >= PU_PURGELEVEL)
+	Z_LinkCache (mainzone, base);
+
+    mainzone->stats.blocks[tag]++;
+    mainzone->stats.bytes[tag] += base->size;
+
     result  = (void *) ((byte *)base + sizeof(memblock_t));
 
     if (base->user)
@@ -281,10 +436,27 @@ Z_Malloc
         *base->user = result;
     }
 
-    // next allocation will start looking here
-    mainzone->rover = base->next;	
-	
     base->id = ZONEID;
+
+    mainzone->stats.mallocs++;
+    mainzone->stats.mallocbytes += base->size;
+#ifdef CLOCK_MONOTONIC
+    if (z_timemallocs)
+    {
+	struct timespec	end;
+	long		ns;
+	int		bucket;
+
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1000000000L
+	   + (end.tv_nsec - start.tv_nsec);
+	for (bucket = 0 ;
+	     bucket < Z_LATENCY_BUCKETS - 1 && ns >= (128L << bucket) ;
+	     bucket++)
+	    ;
+	mainzone->stats.latency[bucket]++;
+    }
+#endif
     
     return result;
 }
@@ -394,6 +566,66 @@ void Z_FileDumpHeap (FILE* f)
 
 
 
+//
+// Z_CheckLists
+// Every free block must be in the right free list and every
+//  purgable block in the cache list.
+//
+static void Z_CheckLists (void)
+{
+    memblock_t*	block;
+    int		freeblocks;
+    int		cacheblocks;
+    int		sizeclass;
+    int		sub;
+    int		i;
+    int		j;
+
+    freeblocks = cacheblocks = 0;
+    for (block = mainzone->blocklist.next ;
+         block != &mainzone->blocklist;
+         block = block->next)
+    {
+	if (block->tag == PU_FREE)
+	    freeblocks++;
+	else if (block->tag >= PU_PURGELEVEL)
+	    cacheblocks++;
+    }
+
+    for (i=0 ; i<NUMCLASSES ; i++)
+    {
+	for (j=0 ; j<NUMSUBS ; j++)
+	{
+	    if (!mainzone->freelists[i][j] != !(mainzone->submap[i] & (1u << j)))
+		I_Error ("Z_CheckHeap: free list map is wrong\n");
+
+	    for (block = mainzone->freelists[i][j] ; block ; block = block->lnext)
+	    {
+		Z_SizeList (block->size, &sizeclass, &sub);
+		if (block->tag != PU_FREE || sizeclass != i || sub != j)
+		    I_Error ("Z_CheckHeap: block in the wrong free list\n");
+		freeblocks--;
+	    }
+	}
+	if (!mainzone->submap[i] != !(mainzone->classmap & (1u << i)))
+	    I_Error ("Z_CheckHeap: free list map is wrong\n");
+    }
+
+    for (block = mainzone->cachelist.lnext ;
+	 block != &mainzone->cachelist ;
+	 block = block->lnext)
+    {
+	if (block->tag < PU_PURGELEVEL || block->lnext->lprev != block)
+	    I_Error ("Z_CheckHeap: bad block in the cache list\n");
+	cacheblocks--;
+    }
+
+    if (freeblocks != 0 || cacheblocks != 0)
+	I_Error ("Z_CheckHeap: block missing from a list\n");
+}
+
+
+
 //
 // Z_CheckHeap
 //
@@ -418,6 +650,8 @@ void Z_CheckHeap (void)
 	if (block->tag == PU_FREE && block->next->tag == PU_FREE)
 	    I_Error ("Z_CheckHeap: two consecutive free blocks\n");
     }
+
+    Z_CheckLists ();
 }
 
 
@@ -440,6 +674,19 @@ void Z_ChangeTag2(void *ptr, int tag, char *file, int line)
         I_Error("%s:%i: Z_ChangeTag: an owner is required "
                 "for purgable blocks", file, line);
 
+    // Making it purgable again counts as a use, so it goes to
+    // the back of the cache list.
+    if (block->tag >= PU_PURGELEVEL)
+        Z_UnlinkCache(block);
+
+    if (tag >= PU_PURGELEVEL)
+        Z_LinkCache(mainzone, block);
+
+    mainzone->stats.blocks[block->tag]--;
+    mainzone->stats.bytes[block->tag] -= block->size;
+    mainzone->stats.blocks[tag]++;
+    mainzone->stats.bytes[tag] += block->size;
+
     block->tag = tag;
 }
 
@@ -481,6 +728,102 @@ int Z_FreeMemory (void)
     return free;
 }
 
+//
+// Z_GetStats
+//
+void Z_GetStats (zonestats_t *stats)
+{
+    memblock_t*		block;
+    int			sizeclass;
+    int			sub;
+
+    *stats = mainzone->stats;
+
+    // the largest free block is in the biggest list there is
+    stats->largestfree = 0;
+    if (mainzone->classmap)
+    {
+        sizeclass = Z_HighBit (mainzone->classmap);
+        sub = Z_HighBit (mainzone->submap[sizeclass]);
+
+        for (block = mainzone->freelists[sizeclass][sub] ;
+             block != NULL ;
+             block = block->lnext)
+        {
+            if (block->size > stats->largestfree)
+                stats->largestfree = block->size;
+        }
+    }
+}
+
+
+//
+// POOLS
+// Each object is preceded by a pointer to its pool,
+//  so Z_PoolFree can be given any pooled object.
+//
+#define POOL_HEADER	((sizeof(zpool_t *) + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1))
+
+static int Z_PoolSlot (zpool_t* pool)
+{
+    return POOL_HEADER + ((pool->size + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1));
+}
+
+//
+// Z_PoolAlloc
+//
+void* Z_PoolAlloc (zpool_t* pool)
+{
+    byte*		slab;
+    byte*		object;
+    int			slot;
+    int			i;
+
+    if (!pool->freelist)
+    {
+        // grab a new slab and put its objects on the free list,
+        //  last first so they get handed out in address order
+        slot = Z_PoolSlot (pool);
+        slab = Z_Malloc (slot * pool->count, pool->tag, NULL);
+
+        for (i = pool->count - 1 ; i >= 0 ; i--)
+        {
+            object = slab + i * slot + POOL_HEADER;
+            *(void **) object = pool->freelist;
+            pool->freelist = object;
+        }
+    }
+
+    object = pool->freelist;
+    pool->freelist = *(void **) object;
+    *(zpool_t **) (object - POOL_HEADER) = pool;
+
+    return object;
+}
+
+//
+// Z_PoolFree
+//
+void Z_PoolFree (void* ptr)
+{
+    zpool_t*		pool;
+
+    pool = *(zpool_t **) ((byte *) ptr - POOL_HEADER);
+
+    *(void **) ptr = pool->freelist;
+    pool->freelist = ptr;
+}
+
+//
+// Z_ClearPool
+// Forgets the free list; the slabs themselves have been,
+//  or are about to be, freed with the rest of their tag.
+//
+void Z_ClearPool (zpool_t* pool)
+{
+    pool->freelist = NULL;
+}
+
 unsigned int Z_ZoneSize(void)
 {
     return mainzone->size;
@@ -50,6 +50,48 @@ enum
 };
         
 
+// Zone telemetry, kept up to date as blocks come and go.
+
+#define Z_LATENCY_BUCKETS	16
+
+typedef struct
+{
+    // blocks and bytes (including headers) by tag; free
+    //  blocks are counted under PU_FREE
+    int		blocks[PU_NUM_TAGS];
+    int		bytes[PU_NUM_TAGS];
+    int		largestfree;
+
+    // purgable blocks thrown out to make room
+    int		purges;
+    int		purgedbytes;
+
+    // Z_Malloc calls, and how long they took: bucket i counts
+    //  calls under 2^(i+7) ns and the last one the rest. Only
+    //  timed while z_timemallocs is set.
+    unsigned int	mallocs;
+    unsigned int	mallocbytes;	// size of the blocks they gave out
+    unsigned int	latency[Z_LATENCY_BUCKETS];
+} zonestats_t;
+
+extern int	z_timemallocs;
+
+
+//
+// Pools of same-sized objects, carved out of zone blocks
+//  ("slabs") with the pool's tag so that objects of one kind
+//  sit next to each other. Freed objects go on the pool's
+//  free list for reuse. The slabs go away when their tag is
+//  freed, so Z_ClearPool must be called at the same time.
+//
+typedef struct
+{
+    int		size;		// of each object
+    int		count;		// objects per slab
+    int		tag;
+    void*	freelist;
+} zpool_t;
+
 void	Z_Init (void);
 void*	Z_Malloc (int size, int tag, void *ptr);
 void    Z_Free (void *ptr);
@@ -60,6 +102,10 @@ void    Z_CheckHeap (void);
 void    Z_ChangeTag2 (void *ptr, int tag, char *file, int line);
 void    Z_ChangeUser(void *ptr, void **user);
 int     Z_FreeMemory (void);
+void    Z_GetStats (zonestats_t *stats);
+void*	Z_PoolAlloc (zpool_t *pool);
+void	Z_PoolFree (void *ptr);
+void	Z_ClearPool (zpool_t *pool);
 unsigned int Z_ZoneSize(void);
 
 //